@@ -0,0 +1,283 @@
+/*
+Culling:
+- Frustum class: the 6 planes of a view frustum, extracted from a clip matrix (projection * view * model), with the test of bounding spheres
+- InstanceCuller class: frustum culling of large numbers of instances of a model, before their upload in an InstanceBuffer
+
+Each instance is approximated with a bounding sphere: its center is the translation of the instance matrix, and its radius is the radius of the model multiplied by the largest scale of the matrix. The spheres are computed once (SetInstances), and stored as a structure of arrays (center x, y, z and radius), so that the test against the planes of the frustum is performed on 4 instances at a time (Frustum::AreSpheresVisible) with SSE instructions (NEON instructions on ARM processors). When neither of them is available, a scalar version of the same test is used.
+The test of the instances can be split among the threads of a JobSystem (see utils/jobs.h); then, the matrices (Cull) or the indices (CullIndices) of the visible instances are copied, in their original order, in a compact array, ready to be uploaded in a buffer.
+New instances can be added at any time (AddInstances), e.g. while they are generated, from their matrices or from their compact transformations (see utils/instance_transform.h).
+
+N.B.) the planes are extracted from the clip matrix with the Gribb-Hartmann method: if the matrix includes the model matrix of the instances (as in our case), the planes are in the model space of the instances, so the spheres do not need to be transformed at each frame
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <vector>
+
+#include <utils/instance_transform.h>
+#include <utils/jobs.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CULLING_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CULLING_NEON
+#endif
+
+/////////////////// FRUSTUM class ///////////////////////
+class Frustum
+{
+public:
+    // planes (a, b, c, d) of the frustum: a point p is inside if a*p.x + b*p.y + c*p.z + d >= 0 for all the planes
+    // order: left, right, bottom, top, near, far
+    glm::vec4 planes[6];
+
+    //////////////////////////////////////////
+    // We extract the planes from the rows of the clip matrix, and we normalize them (so the distances of the points are in world units)
+    Frustum(const glm::mat4 &clip)
+    {
+        // the GLM matrices are stored by columns: clip[column][row]
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++)
+            rows[r] = glm::vec4(clip[0][r], clip[1][r], clip[2][r], clip[3][r]);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            this->planes[2 * axis] = rows[3] + rows[axis];
+            this->planes[2 * axis + 1] = rows[3] - rows[axis];
+        }
+        for (int p = 0; p < 6; p++)
+            this->planes[p] /= glm::length(glm::vec3(this->planes[p]));
+    }
+
+    //////////////////////////////////////////
+    // We test a sphere: it is visible if it is not completely behind one of the planes (from firstPlane to endPlane, excluded)
+    bool IsSphereVisible(const glm::vec3 &center, float radius, int firstPlane = 0, int endPlane = 6) const
+    {
+        for (int p = firstPlane; p < endPlane; p++)
+        {
+            // same order of the operations of the SIMD test (AreSpheresVisible), so the results are identical
+            // (clang may contract a multiplication and an addition in a fused multiply-add, e.g. on arm64: the contraction is disabled)
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+            const glm::vec4 &plane = this->planes[p];
+            float distance = (center.x * plane.x + center.y * plane.y) + (center.z * plane.z + plane.w);
+            if (!(distance > -radius))
+                return false;
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////
+    // We test 4 spheres at a time (centers and radii as structure of arrays), with SSE or NEON instructions when available
+    // only the planes from firstPlane to endPlane (excluded) are considered; the function returns a bit for each sphere not outside them
+    unsigned char AreSpheresVisible(const float* centerX, const float* centerY, const float* centerZ, const float* radius, int firstPlane = 0, int endPlane = 6) const
+    {
+#ifdef CULLING_SSE
+        __m128 x = _mm_loadu_ps(centerX);
+        __m128 y = _mm_loadu_ps(centerY);
+        __m128 z = _mm_loadu_ps(centerZ);
+        __m128 minusRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius));
+        __m128 inside = _mm_cmpeq_ps(minusRadius, minusRadius);
+        for (int p = firstPlane; p < endPlane; p++)
+        {
+            const glm::vec4 &plane = this->planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, minusRadius));
+        }
+        return (unsigned char)_mm_movemask_ps(inside);
+#elif defined(CULLING_NEON)
+        float32x4_t x = vld1q_f32(centerX);
+        float32x4_t y = vld1q_f32(centerY);
+        float32x4_t z = vld1q_f32(centerZ);
+        float32x4_t minusRadius = vnegq_f32(vld1q_f32(radius));
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+        for (int p = firstPlane; p < endPlane; p++)
+        {
+            const glm::vec4 &plane = this->planes[p];
+            // separate multiplications and additions (no vmla/vfma), in the same order of the SSE and scalar tests, so the results are identical
+            float32x4_t distance = vaddq_f32(vaddq_f32(vmulq_n_f32(x, plane.x), vmulq_n_f32(y, plane.y)),
+                                             vaddq_f32(vmulq_n_f32(z, plane.z), vdupq_n_f32(plane.w)));
+            inside = vandq_u32(inside, vcgtq_f32(distance, minusRadius));
+        }
+        // a bit for each lane, as _mm_movemask_ps
+        return (unsigned char)((vgetq_lane_u32(inside, 0) & 1) | (vgetq_lane_u32(inside, 1) & 2) | (vgetq_lane_u32(inside, 2) & 4) | (vgetq_lane_u32(inside, 3) & 8));
+#else
+        unsigned char mask = 0;
+        for (int lane = 0; lane < 4; lane++)
+            if (this->IsSphereVisible(glm::vec3(centerX[lane], centerY[lane], centerZ[lane]), radius[lane], firstPlane, endPlane))
+                mask |= (1 << lane);
+        return mask;
+#endif
+    }
+};
+
+/////////////////// INSTANCECULLER class ///////////////////////
+class InstanceCuller
+{
+public:
+    // threads used for the test of the instances (NULL to test them on the calling thread)
+    JobSystem* jobs;
+    // number of instances set with SetInstances
+    int numInstances;
+    // visible instances, and CPU time (in milliseconds) of the last culling
+    int visibleCount;
+    double cullTime;
+
+    // minimum number of groups of 4 instances tested by a job
+    static const int minParallelGroups = 4096;
+
+    InstanceCuller() : jobs(NULL), numInstances(0), visibleCount(0), cullTime(0.0)
+    {}
+
+    //////////////////////////////////////////
+    // We compute the bounding spheres of the instances, from their matrices and from the radius of the model (in model space)
+    void SetInstances(const glm::mat4* matrices, int n, float modelRadius)
+    {
+        this->numInstances = 0;
+        this->AddInstances(matrices, n, modelRadius);
+    }
+
+    //////////////////////////////////////////
+    // We add the bounding spheres of n new instances, after the ones already set
+    void AddInstances(const glm::mat4* matrices, int n, float modelRadius)
+    {
+        int first = this->Grow(n);
+        for (int k = 0; k < n; k++)
+        {
+            const glm::mat4 &m = matrices[k];
+            int i = first + k;
+            this->centerX[i] = m[3].x;
+            this->centerY[i] = m[3].y;
+            this->centerZ[i] = m[3].z;
+            float scale = glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+            this->radius[i] = modelRadius * scale;
+        }
+    }
+
+    //////////////////////////////////////////
+    // As AddInstances, from the compact transformations of the instances (the radius is scaled by their uniform scale)
+    void AddInstances(const InstanceTransform* transforms, int n, float modelRadius)
+    {
+        int first = this->Grow(n);
+        for (int k = 0; k < n; k++)
+        {
+            int i = first + k;
+            this->centerX[i] = transforms[k].position.x;
+            this->centerY[i] = transforms[k].position.y;
+            this->centerZ[i] = transforms[k].position.z;
+            this->radius[i] = modelRadius * transforms[k].scale;
+        }
+    }
+
+    //////////////////////////////////////////
+    // We test the first count instances against the frustum of the clip matrix, and we copy the matrices of the visible ones in the visible array
+    // (which must have space for count matrices); the function returns the number of visible instances
+    int Cull(const glm::mat4 &clipMatrix, const glm::mat4* matrices, int count, glm::mat4* visible)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        count = this->Test(clipMatrix, count);
+        // the visible matrices are copied in their original order
+        int n = 0;
+        for (int g = 0; 4 * g < count; g++)
+        {
+            unsigned char mask = this->masks[g];
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                int i = 4 * g + lane;
+                if ((mask & 1) && i < count)
+                    visible[n++] = matrices[i];
+            }
+        }
+
+        this->visibleCount = n;
+        this->cullTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return n;
+    }
+
+    //////////////////////////////////////////
+    // As Cull, but the indices of the visible instances are copied in the visible array, instead of their matrices
+    int CullIndices(const glm::mat4 &clipMatrix, int count, unsigned int* visible)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        count = this->Test(clipMatrix, count);
+        int n = 0;
+        for (int g = 0; 4 * g < count; g++)
+        {
+            unsigned char mask = this->masks[g];
+            for (int lane = 0; mask != 0; lane++, mask >>= 1)
+            {
+                int i = 4 * g + lane;
+                if ((mask & 1) && i < count)
+                    visible[n++] = (unsigned int)i;
+            }
+        }
+
+        this->visibleCount = n;
+        this->cullTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return n;
+    }
+
+private:
+    // bounding spheres of the instances (structure of arrays, padded to a multiple of 4)
+    std::vector<float> centerX, centerY, centerZ, radius;
+    // result of the test of each group of 4 instances (a bit for each visible instance)
+    std::vector<unsigned char> masks;
+
+    //////////////////////////////////////////
+    // We add space for n instances, and we return the index of the first one
+    int Grow(int n)
+    {
+        int first = this->numInstances;
+        this->numInstances += n;
+        // the arrays are padded to a multiple of 4, with spheres which are never visible (negative radius)
+        int padded = ((this->numInstances + 3) / 4) * 4;
+        this->centerX.resize(padded, 0.0f);
+        this->centerY.resize(padded, 0.0f);
+        this->centerZ.resize(padded, 0.0f);
+        this->radius.resize(padded, -1e30f);
+        this->masks.resize(padded / 4, 0);
+        return first;
+    }
+
+    //////////////////////////////////////////
+    // We test the spheres of the first count instances (4 at a time), and we set the masks of their groups
+    // the function returns the number of tested instances
+    int Test(const glm::mat4 &clipMatrix, int count)
+    {
+        if (count > this->numInstances)
+            count = this->numInstances;
+        Frustum frustum(clipMatrix);
+        int groups = (count + 3) / 4;
+
+        // a bit for each visible instance
+        if (this->jobs == NULL)
+            this->TestGroups(frustum, 0, groups);
+        else
+            this->jobs->ParallelFor(0, groups, minParallelGroups, 64, [this, &frustum](int b, int e)
+            {
+                this->TestGroups(frustum, b, e);
+            });
+        return count;
+    }
+
+    //////////////////////////////////////////
+    // We test the groups of 4 spheres from begin to end against the planes of the frustum
+    void TestGroups(const Frustum &frustum, int begin, int end)
+    {
+        for (int g = begin; g < end; g++)
+        {
+            int i = 4 * g;
+            this->masks[g] = frustum.AreSpheresVisible(&this->centerX[i], &this->centerY[i], &this->centerZ[i], &this->radius[i]);
+        }
+    }
+};
@@ -0,0 +1,71 @@
+/*
+InstanceBuffer class
+- a VBO with a model matrix for each instance of a Model, for instanced rendering
+
+The matrices are set as per-instance vertex attributes of the VAO of each mesh of the model: a mat4 is passed as 4 vec4 attributes, at locations 3, 4, 5 and 6 (N.B.: they replace the tangent and bitangent attributes set by the Mesh class, not used by our shaders).
+In the vertex shader they are read as:
+layout (location = 3) in mat4 instanceMatrix;
+
+For instances changing at each frame (e.g., the transformations of the rigid bodies), the buffer is "orphaned" at each update (glBufferData with NULL data), so the driver does not need to wait for the previous draw calls to use the buffer.
+The buffer grows when more instances are needed, and it is never reallocated when the number of instances decreases.
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+/////////////////// INSTANCEBUFFER class ///////////////////////
+class InstanceBuffer
+{
+public:
+    GLuint VBO;
+    // number of matrices which can be stored in the buffer
+    GLsizei capacity;
+    // number of matrices set by the last update
+    GLsizei count;
+    // GL_STREAM_DRAW for data updated at each frame, GL_STATIC_DRAW for data set only once
+    GLenum usage;
+
+    //////////////////////////////////////////
+    // constructor: we create the VBO, and we set the per-instance attributes in the VAOs of the meshes of the model
+    InstanceBuffer(Model &model, GLenum usage = GL_STREAM_DRAW) : capacity(0), count(0), usage(usage)
+    {
+        glGenBuffers(1, &this->VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+
+        for (GLuint i = 0; i < model.meshes.size(); i++)
+        {
+            glBindVertexArray(model.meshes[i].VAO);
+            // the reason they are 3,4,5,6 is because it is located at 3
+            // at its vertex shader, and it is mat4 (4 vec4)
+            for (GLuint column = 0; column < 4; column++)
+            {
+                glEnableVertexAttribArray(3 + column);
+                glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+                // the attribute advances once for each instance, and not for each vertex
+                glVertexAttribDivisor(3 + column, 1);
+            }
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    //////////////////////////////////////////
+    // We upload the matrices of the instances
+    void Update(const glm::mat4* matrices, GLsizei n)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        // the buffer is reallocated (with a margin) only if it is not large enough
+        if (n > this->capacity)
+            this->capacity = (n > 2 * this->capacity) ? n : 2 * this->capacity;
+        // orphaning: a new storage is allocated by the driver, without waiting for the previous draw calls
+        glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(glm::mat4), NULL, this->usage);
+        if (n > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, n * sizeof(glm::mat4), matrices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        this->count = n;
+    }
+
+    // We delete the buffer when application closes
+    void Delete() { glDeleteBuffers(1, &this->VBO); }
+};
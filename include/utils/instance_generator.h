@@ -0,0 +1,151 @@
+/*
+InstanceGenerator class:
+- generation of the transformations (InstanceTransform, see utils/instance_transform.h) of large numbers of instances on a worker thread, in batches
+
+The number of instances requested can change at any time (Request): the worker thread generates the missing instances, in batches of batchSize instances, in the order of their index, while the main thread continues rendering. The main thread collects the completed batches with TakeBatches, up to a maximum number of instances per call (e.g., per frame), so the upload of the new instances is spread over many frames, and the frame is never stalled.
+When the number of requested instances decreases, the instances already generated are kept (they are simply not drawn), so they are not generated again if the number increases again.
+
+Each instance is created by a generator function, which receives the index of the instance and the seed of the set: the function must depend only on them (e.g., using a CounterRandom with the index as stream, see utils/random.h), so the instances of a batch can be generated in parallel on the threads of a JobSystem (see utils/jobs.h), and the set depends only on the seed, and not on the number of threads or on the timing of the requests.
+
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <utils/instance_transform.h>
+#include <utils/jobs.h>
+
+/////////////////// INSTANCEGENERATOR class ///////////////////////
+class InstanceGenerator
+{
+public:
+    // function creating the transformation of the instance with the index passed as parameter
+    typedef std::function<InstanceTransform(int index, unsigned int seed)> Generator;
+
+    // number of instances generated together
+    static const int batchSize = 16384;
+    // minimum number of instances generated by a job
+    static const int minParallelInstances = 2048;
+
+    //////////////////////////////////////////
+    // constructor: the worker thread starts, waiting for the first request
+    // the batches are generated on the threads of jobs (or only on the worker thread, if NULL)
+    InstanceGenerator(Generator generator, unsigned int seed = 0, JobSystem* jobs = NULL)
+        : generator(generator), seed(seed), jobs(jobs), requested(0), generated(0), taken(0), quit(false)
+    {
+        this->worker = std::thread(&InstanceGenerator::WorkerLoop, this);
+    }
+
+    ~InstanceGenerator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->quit = true;
+        }
+        this->wakeUp.notify_all();
+        this->worker.join();
+    }
+
+    //////////////////////////////////////////
+    // We generate the instances from first to last in out (out[0] is the instance first), splitting them among the threads of jobs (if not NULL)
+    static void Generate(const Generator &generator, unsigned int seed, int first, int last, InstanceTransform* out, JobSystem* jobs = NULL)
+    {
+        if (jobs == NULL)
+        {
+            for (int i = first; i < last; i++)
+                out[i - first] = generator(i, seed);
+            return;
+        }
+        // the chunk boundaries are multiples of 4 instances (192 bytes): if out is aligned to 64 bytes, two threads never write in the same cache line
+        jobs->ParallelFor(first, last, minParallelInstances, 4, [&generator, seed, first, out](int b, int e)
+        {
+            for (int i = b; i < e; i++)
+                out[i - first] = generator(i, seed);
+        });
+    }
+
+    //////////////////////////////////////////
+    // We request n instances: if they are not generated yet, the worker thread generates them
+    void Request(int n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (n <= this->requested)
+                return;
+            this->requested = n;
+        }
+        this->wakeUp.notify_all();
+    }
+
+    //////////////////////////////////////////
+    // We move the completed batches in out (after its content), up to maxInstances instances (at least one batch, if available)
+    // the function returns the number of instances taken
+    int TakeBatches(std::vector<InstanceTransform> &out, int maxInstances)
+    {
+        int n = 0;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        while (!this->batches.empty() && (n == 0 || n + (int)this->batches.front().size() <= maxInstances))
+        {
+            std::vector<InstanceTransform> &batch = this->batches.front();
+            out.insert(out.end(), batch.begin(), batch.end());
+            n += (int)batch.size();
+            this->batches.pop_front();
+        }
+        this->taken += n;
+        return n;
+    }
+
+    // number of instances requested, generated by the worker thread, and taken by TakeBatches
+    int Requested() { std::lock_guard<std::mutex> lock(this->mutex); return this->requested; }
+    int Generated() { std::lock_guard<std::mutex> lock(this->mutex); return this->generated; }
+    int Taken() { std::lock_guard<std::mutex> lock(this->mutex); return this->taken; }
+
+private:
+    Generator generator;
+    unsigned int seed;
+    JobSystem* jobs;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    int requested, generated, taken;
+    bool quit;
+    // batches generated and not taken yet
+    std::deque< std::vector<InstanceTransform> > batches;
+
+    //////////////////////////////////////////
+    // main loop of the worker thread: it generates a batch at a time, until all the requested instances are generated
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            int first, last;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wakeUp.wait(lock, [this] { return this->quit || this->requested > this->generated; });
+                if (this->quit)
+                    return;
+                first = this->generated;
+                last = (this->requested < first + batchSize) ? this->requested : first + batchSize;
+            }
+
+            // the batch is generated without holding the lock
+            std::vector<InstanceTransform> batch(last - first);
+            Generate(this->generator, this->seed, first, last, batch.data(), this->jobs);
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->batches.push_back(std::vector<InstanceTransform>());
+            this->batches.back().swap(batch);
+            this->generated = last;
+        }
+    }
+};
@@ -0,0 +1,235 @@
+/*
+InstanceManager class:
+- a set of instances of a Model which can grow to millions at runtime, generated on a worker thread and uploaded incrementally
+
+The transformations are created by an InstanceGenerator (see utils/instance_generator.h) on its worker thread. At each frame (Update), the main thread takes the completed batches, up to uploadBudget instances, encodes them, and appends them to a GPU buffer with glBufferSubData, so the upload of a large set is spread over many frames and the frame is never stalled. When the buffer is full, it is reallocated with double capacity, and the instances already uploaded are copied on the GPU (glCopyBufferSubData), without passing through the CPU.
+The instances are stored with a compact encoding (see utils/instance_transform.h), and the vertex shader rebuilds their matrices:
+- COMPACT_INSTANCES: position, scale, quaternion and spin as floats (InstanceTransform), 48 bytes for each instance, 3 texels of a GL_RGBA32F texture buffer
+- QUANTIZED_INSTANCES: the same data as 16 bit integers (QuantizedTransform), 24 bytes for each instance, 3 texels of a GL_RGBA16 texture buffer; the bounds used for the quantization are passed to the shader as uniforms
+The spin of the instances is animated in the shader, from the time passed to SetUniforms: the buffer is never updated after the upload of the instances.
+The data are read in the vertex shader from the buffer through a texture buffer object: OpenGL 4.1 has no shader storage buffers, and per-instance attributes would require a copy of the data of the visible instances at each frame.
+At each frame (Cull), the instances are culled on the CPU (see utils/culling.h), and only the indices of the visible ones are uploaded in a small per-instance attribute (4 bytes for each visible instance, instead of 64), at location 3:
+layout (location = 3) in uint instanceIndex;
+uniform samplerBuffer instanceData;
+uniform int instanceEncoding;
+uniform vec3 boundsMin, boundsSize;
+uniform float maxScale, maxSpinSpeed;
+uniform float time;
+
+N.B.) the per-instance attribute replaces the tangent attribute set by the Mesh class in the VAOs of the model (not used by our shaders)
+N.B.) the texture buffer (dataTexture) must be bound by the caller, e.g. through the cache of the state (see utils/render_state.h): SetUniforms sets the sampler to its texture unit, and the uniforms of the encoding (utils/shader.h must be included before this file)
+N.B.) the reallocation of the buffer in Update binds the texture buffer outside the cache of the state: Update must be called before the state is used in the frame (or Invalidate must be called after it)
+N.B.) the culler receives the transformations read by the shader (dequantized, with QUANTIZED_INSTANCES), so the culled spheres are exactly the rendered ones
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <vector>
+
+#include <utils/instance_generator.h>
+#include <utils/instance_transform.h>
+#include <utils/culling.h>
+
+// encoding of the instances in the GPU buffer
+enum InstanceEncoding { COMPACT_INSTANCES, QUANTIZED_INSTANCES };
+
+/////////////////// INSTANCEMANAGER class ///////////////////////
+class InstanceManager
+{
+public:
+    InstanceGenerator generator;
+    InstanceCuller culler;
+
+    // encoding of the instances, and bounds of the quantization (used only with QUANTIZED_INSTANCES)
+    InstanceEncoding encoding;
+    InstanceQuantizer quantizer;
+
+    // buffer of the instances, and texture buffer used to read it in the shaders
+    GLuint dataBuffer, dataTexture;
+    // buffer of the indices of the visible instances
+    GLuint indexBuffer;
+
+    // instances uploaded, and number of instances which can be stored in the buffer
+    int uploaded;
+    int capacity;
+    // maximum number of instances, given by the maximum size of a texture buffer
+    int maxInstances;
+    // maximum number of instances uploaded at each frame
+    int uploadBudget;
+    // number of instances visible after the last culling
+    GLsizei visibleCount;
+    // bytes of each instance in the buffer
+    int instanceSize;
+    // CPU time (in milliseconds) spent in the last Update, and reallocations of the buffer
+    double uploadTime;
+    unsigned long reallocations;
+
+    //////////////////////////////////////////
+    // constructor: we create the buffers, and we set the per-instance attribute in the VAOs of the meshes of the model
+    // (seed is the seed of the instances, and jobs are the threads used to generate and cull them)
+    InstanceManager(Model &model, float modelRadius, InstanceGenerator::Generator instanceGenerator, unsigned int seed = 0, JobSystem* jobs = NULL,
+                    InstanceEncoding encoding = COMPACT_INSTANCES, InstanceQuantizer quantizer = InstanceQuantizer(), int uploadBudget = 65536)
+        : generator(instanceGenerator, seed, jobs), encoding(encoding), quantizer(quantizer), uploaded(0), capacity(0), uploadBudget(uploadBudget), visibleCount(0),
+          instanceSize((encoding == QUANTIZED_INSTANCES) ? sizeof(QuantizedTransform) : sizeof(InstanceTransform)), uploadTime(0.0), reallocations(0), boundProgram(0), modelRadius(modelRadius)
+    {
+        this->culler.jobs = jobs;
+
+        // 3 texels for each instance
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        this->maxInstances = maxTexels / 3;
+
+        glGenBuffers(1, &this->dataBuffer);
+        glGenTextures(1, &this->dataTexture);
+        this->Allocate(InstanceGenerator::batchSize);
+
+        glGenBuffers(1, &this->indexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, this->indexBuffer);
+        for (GLuint i = 0; i < model.meshes.size(); i++)
+        {
+            glBindVertexArray(model.meshes[i].VAO);
+            glEnableVertexAttribArray(3);
+            // integer attribute: glVertexAttribIPointer, so the index is not converted to float
+            glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+            // the attribute advances once for each instance, and not for each vertex
+            glVertexAttribDivisor(3, 1);
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    //////////////////////////////////////////
+    // We request n instances (clamped to maxInstances): the missing ones are generated on the worker thread
+    void Request(int n)
+    {
+        this->generator.Request((n < this->maxInstances) ? n : this->maxInstances);
+    }
+
+    //////////////////////////////////////////
+    // We upload the instances generated since the last frame (up to uploadBudget), after the ones already uploaded
+    void Update()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        this->staging.clear();
+        int n = this->generator.TakeBatches(this->staging, this->uploadBudget);
+        if (n > 0)
+        {
+            if (this->uploaded + n > this->capacity)
+                this->Allocate(this->uploaded + n);
+            const void* data = this->staging.data();
+            if (this->encoding == QUANTIZED_INSTANCES)
+            {
+                // the culler receives the transformations rebuilt by the shader
+                this->quantized.resize(n);
+                for (int i = 0; i < n; i++)
+                {
+                    this->quantized[i] = this->quantizer.Quantize(this->staging[i]);
+                    this->staging[i] = this->quantizer.Dequantize(this->quantized[i]);
+                }
+                data = this->quantized.data();
+            }
+            glBindBuffer(GL_TEXTURE_BUFFER, this->dataBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)this->uploaded * this->instanceSize, (GLsizeiptr)n * this->instanceSize, data);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            this->culler.AddInstances(this->staging.data(), n, this->modelRadius);
+            this->uploaded += n;
+        }
+
+        this->uploadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //////////////////////////////////////////
+    // We cull the first count instances (only the uploaded ones are considered), and we upload the indices of the visible ones
+    void Cull(const glm::mat4 &clipMatrix, int count)
+    {
+        if (this->visibleIndices.size() < (size_t)this->uploaded)
+            this->visibleIndices.resize(this->uploaded);
+        this->visibleCount = this->culler.CullIndices(clipMatrix, count, this->visibleIndices.data());
+
+        glBindBuffer(GL_ARRAY_BUFFER, this->indexBuffer);
+        // orphaning: a new storage is allocated by the driver, without waiting for the previous draw calls
+        glBufferData(GL_ARRAY_BUFFER, this->visibleIndices.size() * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+        if (this->visibleCount > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, this->visibleCount * sizeof(GLuint), this->visibleIndices.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    //////////////////////////////////////////
+    // We set the sampler of the texture buffer of the instances (bound to a texture unit), the uniforms of the encoding and the time of the animation (in seconds) in the (active) shader
+    // the locations of the uniforms are determined only when the shader changes
+    void SetUniforms(Shader &shader, GLuint unit, float time)
+    {
+        if (shader.Program != this->boundProgram)
+        {
+            const char* names[NUM_UNIFORMS] = { "instanceData", "instanceEncoding", "boundsMin", "boundsSize", "maxScale", "maxSpinSpeed", "time" };
+            for (int u = 0; u < NUM_UNIFORMS; u++)
+                this->locations[u] = shader.Uniform(names[u]);
+            this->boundProgram = shader.Program;
+        }
+        shader.SetInt(this->locations[INSTANCE_DATA_UNIFORM], unit);
+        shader.SetInt(this->locations[INSTANCE_ENCODING_UNIFORM], (GLint)this->encoding);
+        shader.SetVec3(this->locations[BOUNDS_MIN_UNIFORM], this->quantizer.boundsMin);
+        shader.SetVec3(this->locations[BOUNDS_SIZE_UNIFORM], this->quantizer.boundsSize);
+        shader.SetFloat(this->locations[MAX_SCALE_UNIFORM], this->quantizer.maxScale);
+        shader.SetFloat(this->locations[MAX_SPIN_SPEED_UNIFORM], this->quantizer.maxSpinSpeed);
+        shader.SetFloat(this->locations[TIME_UNIFORM], time);
+    }
+
+    // We delete the buffers when application closes
+    void Delete()
+    {
+        glDeleteTextures(1, &this->dataTexture);
+        glDeleteBuffers(1, &this->dataBuffer);
+        glDeleteBuffers(1, &this->indexBuffer);
+    }
+
+private:
+    // uniforms set by SetUniforms, and their locations in the last shader
+    enum Uniforms { INSTANCE_DATA_UNIFORM, INSTANCE_ENCODING_UNIFORM, BOUNDS_MIN_UNIFORM, BOUNDS_SIZE_UNIFORM, MAX_SCALE_UNIFORM, MAX_SPIN_SPEED_UNIFORM, TIME_UNIFORM, NUM_UNIFORMS };
+    GLuint boundProgram;
+    GLint locations[NUM_UNIFORMS];
+
+    float modelRadius;
+    // instances taken from the generator in the current frame, and their quantized version
+    std::vector<InstanceTransform> staging;
+    std::vector<QuantizedTransform> quantized;
+    // indices of the visible instances
+    std::vector<GLuint> visibleIndices;
+
+    //////////////////////////////////////////
+    // We reallocate the buffer of the instances, with space for at least n instances (doubling its capacity)
+    void Allocate(int n)
+    {
+        int newCapacity = (this->capacity > 0) ? this->capacity : n;
+        while (newCapacity < n)
+            newCapacity *= 2;
+        if (newCapacity > this->maxInstances)
+            newCapacity = this->maxInstances;
+
+        GLuint newBuffer;
+        glGenBuffers(1, &newBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * this->instanceSize, NULL, GL_STATIC_DRAW);
+        if (this->capacity > 0)
+        {
+            // the instances already uploaded are copied on the GPU
+            glBindBuffer(GL_COPY_READ_BUFFER, this->dataBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)this->uploaded * this->instanceSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            this->reallocations++;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &this->dataBuffer);
+        this->dataBuffer = newBuffer;
+        this->capacity = newCapacity;
+
+        // the texture now reads the new buffer
+        glBindTexture(GL_TEXTURE_BUFFER, this->dataTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, (this->encoding == QUANTIZED_INSTANCES) ? GL_RGBA16 : GL_RGBA32F, this->dataBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+};
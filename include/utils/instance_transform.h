@@ -0,0 +1,123 @@
+/*
+Compact encoding of the transformation of an instance:
+- InstanceTransform: position, uniform scale, rotation (a unit quaternion) and spin animation, 48 bytes (a mat4 is 64 bytes, without animation)
+- QuantizedTransform: the same data quantized to 16 bit integers, 24 bytes
+- InstanceQuantizer: the conversion between the two, given the bounds of the positions and the maximum scale of a set of instances
+
+The transformations of the instances of the background are always translate * scale * rotate, so a full matrix stores mostly redundant data: the matrix is rebuilt in the vertex shader (see instance.vert), with the same formulas of InstanceTransform::Matrix.
+Each instance spins around its own axis: the spin is stored once, as the axis multiplied by the angular speed (radians per second) and the initial angle (phase), and the rotation at time t (spin of phase + speed * t around the axis, applied after the initial rotation) is evaluated in the vertex shader from a time uniform, so the animation of millions of instances does not need any upload. InstanceTransform::Matrix(time) is the reference implementation on the CPU, used by the headless simulation to verify the animation.
+In the quantized version, each coordinate of the position is stored as a 16 bit fraction of the bounds of the set, the scale as a fraction of the maximum scale, each component of the quaternion, in [-1, 1], as a 16 bit fraction of the same interval, the spin as a fraction of the maximum angular speed, and the phase as a fraction of 2 pi: they are read in the shader from a GL_RGBA16 texture buffer (normalized to [0, 1]), 3 texels for each instance.
+
+N.B.) the rotation is stored as a vec4 (x, y, z, w), and not as a glm::quat, whose order of the components in memory depends on the version of GLM
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+/////////////////// INSTANCETRANSFORM struct ///////////////////////
+struct InstanceTransform
+{
+    glm::vec3 position;
+    float scale;
+    // unit quaternion (x, y, z, w)
+    glm::vec4 rotation;
+    // spin: axis multiplied by the angular speed (in radians per second), and phase (in radians, in [0, 2 pi))
+    glm::vec4 spin;
+
+    //////////////////////////////////////////
+    // We return the rotation (quaternion) at a time: the spin of phase + speed * time around the axis, after the initial rotation (the same computation of instance.vert)
+    glm::vec4 Rotation(float time) const
+    {
+        float speed = glm::length(glm::vec3(this->spin));
+        glm::vec3 axis = (speed > 0.0f) ? glm::vec3(this->spin) / speed : glm::vec3(0.0f);
+        float halfAngle = 0.5f * (this->spin.w + speed * time);
+        glm::vec3 spinVector = axis * glm::sin(halfAngle);
+        float spinScalar = glm::cos(halfAngle);
+        // quaternion product spin * rotation
+        glm::vec3 v = glm::vec3(this->rotation);
+        return glm::vec4(spinScalar * v + this->rotation.w * spinVector + glm::cross(spinVector, v), spinScalar * this->rotation.w - glm::dot(spinVector, v));
+    }
+
+    //////////////////////////////////////////
+    // We rebuild the matrix translate * scale * rotate at a time (the same computation of instance.vert)
+    glm::mat4 Matrix(float time = 0.0f) const
+    {
+        glm::vec4 q = this->Rotation(time);
+        float x = q.x, y = q.y, z = q.z, w = q.w;
+        glm::mat4 m;
+        m[0] = glm::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * this->scale;
+        m[1] = glm::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * this->scale;
+        m[2] = glm::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * this->scale;
+        m[3] = glm::vec4(this->position, 1.0f);
+        return m;
+    }
+};
+
+/////////////////// QUANTIZEDTRANSFORM struct ///////////////////////
+struct QuantizedTransform
+{
+    // position and scale, as fractions of the bounds and of the maximum scale of the InstanceQuantizer
+    uint16_t position[3];
+    uint16_t scale;
+    // quaternion, each component mapped from [-1, 1] to [0, 65535]
+    uint16_t rotation[4];
+    // spin, as a fraction of the maximum angular speed (mapped as the quaternion), and phase, as a fraction of 2 pi
+    uint16_t spin[4];
+};
+
+/////////////////// INSTANCEQUANTIZER class ///////////////////////
+class InstanceQuantizer
+{
+public:
+    // bounds of the positions of the instances, maximum scale, and maximum angular speed of the spin
+    glm::vec3 boundsMin, boundsSize;
+    float maxScale;
+    float maxSpinSpeed;
+
+    InstanceQuantizer(glm::vec3 boundsMin = glm::vec3(-1.0f), glm::vec3 boundsMax = glm::vec3(1.0f), float maxScale = 1.0f, float maxSpinSpeed = 1.0f)
+        : boundsMin(boundsMin), boundsSize(boundsMax - boundsMin), maxScale(maxScale), maxSpinSpeed(maxSpinSpeed)
+    {}
+
+    //////////////////////////////////////////
+    // We quantize a transformation (the values outside the bounds are clamped)
+    QuantizedTransform Quantize(const InstanceTransform &t) const
+    {
+        QuantizedTransform q;
+        glm::vec3 position = (t.position - this->boundsMin) / this->boundsSize;
+        for (int c = 0; c < 3; c++)
+            q.position[c] = ToUnorm16(position[c]);
+        q.scale = ToUnorm16(t.scale / this->maxScale);
+        for (int c = 0; c < 4; c++)
+            q.rotation[c] = ToUnorm16(t.rotation[c] * 0.5f + 0.5f);
+        for (int c = 0; c < 3; c++)
+            q.spin[c] = ToUnorm16(t.spin[c] / this->maxSpinSpeed * 0.5f + 0.5f);
+        // the phase is periodic: 65535 is never used, so the phases close to 2 pi are rounded to 0
+        q.spin[3] = (uint16_t)((uint32_t)(glm::fract(t.spin.w / TwoPi()) * 65535.0f + 0.5f) % 65535);
+        return q;
+    }
+
+    //////////////////////////////////////////
+    // We rebuild the transformation (as the shader does, the quaternion is normalized again)
+    InstanceTransform Dequantize(const QuantizedTransform &q) const
+    {
+        InstanceTransform t;
+        t.position = this->boundsMin + glm::vec3(q.position[0], q.position[1], q.position[2]) / 65535.0f * this->boundsSize;
+        t.scale = q.scale / 65535.0f * this->maxScale;
+        t.rotation = glm::normalize(glm::vec4(q.rotation[0], q.rotation[1], q.rotation[2], q.rotation[3]) / 65535.0f * 2.0f - 1.0f);
+        t.spin = glm::vec4((glm::vec3(q.spin[0], q.spin[1], q.spin[2]) / 65535.0f * 2.0f - 1.0f) * this->maxSpinSpeed, q.spin[3] / 65535.0f * TwoPi());
+        return t;
+    }
+
+private:
+    static float TwoPi() { return 6.28318530718f; }
+
+    static uint16_t ToUnorm16(float v)
+    {
+        v = glm::clamp(v, 0.0f, 1.0f);
+        return (uint16_t)(v * 65535.0f + 0.5f);
+    }
+};
@@ -0,0 +1,245 @@
+/*
+JobSystem class:
+- a small pool of worker threads, with work stealing, to split a loop over many threads (ParallelFor)
+
+Each thread (the workers, and the thread calling ParallelFor, which works too) has its own queue of jobs. ParallelFor splits the range of the loop in chunks, and distributes them among the queues: each thread takes the jobs from the back of its own queue, and when its queue is empty it steals the jobs from the front of the queues of the other threads, so the threads finishing earlier help the slower ones.
+The chunk boundaries are multiples of the alignment requested by the caller (e.g., the number of floats in a cache line), so two threads never write in the same cache line of an array, and each chunk always covers the same elements, independently of the thread running it: if each element is processed independently of the others, the result does not depend on the number of threads.
+
+N.B.) ParallelFor can be called by several threads at the same time (e.g., by the main thread and by the worker thread of an InstanceGenerator): the callers share queue 0, and each one runs only the chunks of its own loop, so a loop never waits for the chunks of another one (e.g., the particles of a frame for the generation of the background). When no chunk of its loop is left in the queues, the caller sleeps until the last ones, run by the workers, are done
+N.B.) the class does not depend on OpenGL or Bullet, so it can be used by any subsystem (and by the headless simulation)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/////////////////// JOBSYSTEM class ///////////////////////
+class JobSystem
+{
+public:
+    // the body of a loop, called for the range [begin, end)
+    typedef std::function<void(int begin, int end)> RangeFunction;
+
+    // number of floats in a cache line (64 bytes)
+    static const int cacheLineFloats = 16;
+
+    //////////////////////////////////////////
+    // constructor: threads is the total number of threads (the calling thread plus the workers), 0 to use all the hardware threads
+    JobSystem(int threads = 0) : quit(false), queued(0)
+    {
+        if (threads <= 0)
+            threads = (int)std::thread::hardware_concurrency();
+        if (threads <= 0)
+            threads = 1;
+
+        // queue 0 is used by the thread calling ParallelFor
+        this->queues.resize(threads);
+        for (int t = 0; t < threads; t++)
+            this->queues[t] = new JobQueue();
+        for (int t = 1; t < threads; t++)
+            this->workers.push_back(std::thread(&JobSystem::WorkerLoop, this, t));
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->quit = true;
+        }
+        this->wakeUp.notify_all();
+        for (size_t w = 0; w < this->workers.size(); w++)
+            this->workers[w].join();
+        for (size_t q = 0; q < this->queues.size(); q++)
+            delete this->queues[q];
+    }
+
+    // total number of threads (the calling thread plus the workers)
+    int NumThreads() const { return (int)this->queues.size(); }
+
+    //////////////////////////////////////////
+    // We call body on the range [begin, end), split in chunks of at least minChunk elements
+    // the boundaries between the chunks are multiples of alignment (counted from 0, not from begin)
+    // the function returns when all the chunks have been processed
+    void ParallelFor(int begin, int end, int minChunk, int alignment, const RangeFunction &body)
+    {
+        if (end <= begin)
+            return;
+        int threads = this->NumThreads();
+        // a few chunks for each thread, so that the work can be balanced by stealing
+        int chunk = (end - begin) / (threads * 4);
+        if (chunk < minChunk)
+            chunk = minChunk;
+        chunk = ((chunk + alignment - 1) / alignment) * alignment;
+        if (threads == 1 || chunk >= end - begin)
+        {
+            body(begin, end);
+            return;
+        }
+
+        // we split the range, and we distribute the chunks among the queues
+        std::atomic<int> pending(0);
+        std::vector<Job> jobs;
+        int start = begin;
+        for (int boundary = ((begin + chunk + alignment - 1) / alignment) * alignment; start < end; boundary += chunk)
+        {
+            Job job;
+            job.body = &body;
+            job.begin = start;
+            job.end = (boundary < end) ? boundary : end;
+            job.pending = &pending;
+            jobs.push_back(job);
+            start = job.end;
+        }
+        pending = (int)jobs.size();
+        for (size_t j = 0; j < jobs.size(); j++)
+            this->queues[j % threads]->Push(jobs[j]);
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->queued += (int)jobs.size();
+        }
+        this->wakeUp.notify_all();
+
+        // the calling thread works too, on the chunks of its loop only, and then it waits for the chunks run by the workers
+        Job job;
+        while (pending.load() > 0 && this->FindLoopJob(&pending, job))
+            this->Run(job);
+        std::unique_lock<std::mutex> lock(this->doneMutex);
+        this->loopDone.wait(lock, [&pending] { return pending.load() == 0; });
+    }
+
+private:
+    // a chunk of a loop
+    struct Job {
+        const RangeFunction* body;
+        int begin, end;
+        std::atomic<int>* pending;  // chunks of the loop not finished yet
+    };
+
+    // the queue of jobs of a thread
+    struct JobQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+
+        void Push(const Job &job)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->jobs.push_back(job);
+        }
+        // the owner takes the last job
+        bool Pop(Job &job)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->jobs.empty())
+                return false;
+            job = this->jobs.back();
+            this->jobs.pop_back();
+            return true;
+        }
+        // the other threads steal the first job
+        bool Steal(Job &job)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->jobs.empty())
+                return false;
+            job = this->jobs.front();
+            this->jobs.pop_front();
+            return true;
+        }
+        // a caller of ParallelFor takes the last job of its loop
+        bool TakeLoop(const std::atomic<int>* pending, Job &job)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (std::deque<Job>::reverse_iterator j = this->jobs.rbegin(); j != this->jobs.rend(); ++j)
+                if (j->pending == pending)
+                {
+                    job = *j;
+                    this->jobs.erase(std::next(j).base());
+                    return true;
+                }
+            return false;
+        }
+    };
+
+    std::vector<JobQueue*> queues;
+    std::vector<std::thread> workers;
+
+    // the idle workers sleep until new jobs are queued
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool quit;
+    // number of jobs in the queues
+    int queued;
+
+    // the callers of ParallelFor sleep until the last chunk of their loop is done
+    std::mutex doneMutex;
+    std::condition_variable loopDone;
+
+    //////////////////////////////////////////
+    // We take a job from the queue of the thread, or we steal it from the other queues
+    bool FindJob(int thread, Job &job)
+    {
+        bool found = this->queues[thread]->Pop(job);
+        for (int i = 1; !found && i < this->NumThreads(); i++)
+            found = this->queues[(thread + i) % this->NumThreads()]->Steal(job);
+        if (found)
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->queued--;
+        }
+        return found;
+    }
+
+    //////////////////////////////////////////
+    // We take a job of a loop (identified by its counter of pending chunks) from any queue, starting from queue 0
+    bool FindLoopJob(const std::atomic<int>* pending, Job &job)
+    {
+        bool found = false;
+        for (int q = 0; !found && q < this->NumThreads(); q++)
+            found = this->queues[q]->TakeLoop(pending, job);
+        if (found)
+        {
+            std::lock_guard<std::mutex> lock(this->sleepMutex);
+            this->queued--;
+        }
+        return found;
+    }
+
+    //////////////////////////////////////////
+    // We run a job, and we signal its end: after the last chunk of a loop, the callers waiting are woken up
+    // (the counter is not touched after the decrement: the caller can return, and destroy it, as soon as it is 0)
+    void Run(const Job &job)
+    {
+        (*job.body)(job.begin, job.end);
+        if (job.pending->fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(this->doneMutex);
+            this->loopDone.notify_all();
+        }
+    }
+
+    //////////////////////////////////////////
+    // main loop of a worker thread
+    void WorkerLoop(int thread)
+    {
+        Job job;
+        while (true)
+        {
+            if (this->FindJob(thread, job))
+            {
+                this->Run(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(this->sleepMutex);
+            this->wakeUp.wait(lock, [this] { return this->quit || this->queued > 0; });
+            if (this->quit)
+                return;
+        }
+    }
+};
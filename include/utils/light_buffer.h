@@ -0,0 +1,107 @@
+/*
+LightBuffer class:
+- the buffers of the lights assigned to the screen tiles by a LightTiler (see utils/light_tiles.h), read in the fragment shader through texture buffer objects
+
+OpenGL 4.1 has no shader storage buffers, and the size of a uniform block is limited (16 KB on many drivers, about 500 lights): the lights, the ranges of the tiles and the indices are uploaded at each frame (Update) in three buffers, read through texture buffers:
+uniform samplerBuffer lightData;        // GL_RGBA32F, 2 texels for each light
+uniform usamplerBuffer tileLights;      // GL_RG32UI, offset and number of lights of each tile
+uniform usamplerBuffer lightIndices;    // GL_R16UI, indices of the lights
+
+The buffers are orphaned at each upload (see utils/instance_buffer.h), and they grow when needed.
+
+N.B.) the three texture buffers (textures) must be bound by the caller to three consecutive texture units, e.g. through the cache of the state (see utils/render_state.h): SetSamplers sets the samplers to the units, starting from the one passed (utils/shader.h must be included before this file)
+N.B.) the size of the tiles and their number on the x-axis are needed by the shader to find the tile of a fragment: they are passed with the other per-frame data (see the Lights block in 14_illumination_models_ML_TX.frag)
+*/
+
+#pragma once
+
+#include <utils/light_tiles.h>
+
+/////////////////// LIGHTBUFFER class ///////////////////////
+class LightBuffer
+{
+public:
+    // buffers of the lights, of the ranges of the tiles and of the indices, and their texture buffers
+    GLuint buffers[3];
+    GLuint textures[3];
+    // bytes allocated for each buffer
+    GLsizeiptr capacity[3];
+    // bytes uploaded in the last Update
+    GLsizeiptr uploadedBytes;
+
+    //////////////////////////////////////////
+    // constructor: we create the buffers and their texture buffers
+    LightBuffer() : uploadedBytes(0), boundProgram(0)
+    {
+        glGenBuffers(3, this->buffers);
+        glGenTextures(3, this->textures);
+        // the format of the texels of each buffer
+        const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+        for (int b = 0; b < 3; b++)
+        {
+            this->capacity[b] = 0;
+            this->Upload(b, NULL, 64);
+            // the texture reads the buffer also after the orphaning (the name of the buffer does not change)
+            glBindTexture(GL_TEXTURE_BUFFER, this->textures[b]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[b], this->buffers[b]);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+
+    //////////////////////////////////////////
+    // We upload the lights and their assignment to the tiles
+    void Update(const LightTiler &tiler)
+    {
+        this->uploadedBytes = 0;
+        this->Upload(LIGHT_DATA_BUFFER, tiler.viewLights.data(), (GLsizeiptr)tiler.viewLights.size() * sizeof(PointLight));
+        this->Upload(TILE_LIGHTS_BUFFER, tiler.tileRanges.data(), (GLsizeiptr)tiler.tileRanges.size() * sizeof(uint32_t));
+        this->Upload(LIGHT_INDICES_BUFFER, tiler.lightIndices.data(), (GLsizeiptr)tiler.lightIndices.size() * sizeof(uint16_t));
+    }
+
+    //////////////////////////////////////////
+    // We set the samplers of the texture buffers in the (active) shader, to the texture units from firstUnit to firstUnit + 2
+    // the locations of the samplers are determined only when the shader changes
+    void SetSamplers(Shader &shader, GLuint firstUnit)
+    {
+        if (shader.Program != this->boundProgram)
+        {
+            const char* names[3] = { "lightData", "tileLights", "lightIndices" };
+            for (int b = 0; b < 3; b++)
+                this->locations[b] = shader.Uniform(names[b]);
+            this->boundProgram = shader.Program;
+        }
+        for (int b = 0; b < 3; b++)
+            shader.SetInt(this->locations[b], firstUnit + b);
+    }
+
+    // We delete the buffers when application closes
+    void Delete()
+    {
+        glDeleteTextures(3, this->textures);
+        glDeleteBuffers(3, this->buffers);
+    }
+
+private:
+    enum Buffers { LIGHT_DATA_BUFFER, TILE_LIGHTS_BUFFER, LIGHT_INDICES_BUFFER };
+    // location of the sampler of each buffer in the last shader
+    GLuint boundProgram;
+    GLint locations[3];
+
+    //////////////////////////////////////////
+    // We upload size bytes in a buffer: the buffer is orphaned, and it is reallocated with double capacity if it is not large enough
+    void Upload(int b, const void* data, GLsizeiptr size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, this->buffers[b]);
+        if (size > this->capacity[b])
+        {
+            this->capacity[b] = (this->capacity[b] > 0) ? this->capacity[b] : size;
+            while (this->capacity[b] < size)
+                this->capacity[b] *= 2;
+        }
+        glBufferData(GL_TEXTURE_BUFFER, this->capacity[b], NULL, GL_STREAM_DRAW);
+        if (data != NULL && size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        this->uploadedBytes += size;
+    }
+};
@@ -0,0 +1,235 @@
+/*
+Tiled lighting:
+- PointLight struct: a point light with a limited range (position, radius, color, intensity)
+- LightTiler class: assignment of any number of point lights to the screen tiles they can illuminate, so that each fragment evaluates only the lights of its tile
+
+The screen is divided in square tiles of tileSize pixels. Each tile is a small frustum (the part of the view frustum projected on the tile), and each light is a sphere of its radius: a light is assigned to a tile if its sphere is not outside the frustum of the tile. The frustum of each tile is extracted from the projection matrix, scaled and translated so that the tile covers the whole clip space, and the spheres are tested in view coordinates, 4 at a time with the SIMD test of utils/culling.h (Frustum::AreSpheresVisible).
+The test is separable: the left and right planes of a tile depend only on its column, and the bottom, top, near and far planes only on its row. So the lights are tested only against the planes of each column and of each row of tiles, and the mask of the lights of a tile is the AND of the masks of its column and of its row (the result is identical to the test against the 6 planes of each tile, with far fewer tests).
+The tiles are split among the threads of a JobSystem (see utils/jobs.h) in three passes: the first one tests the lights against the columns and the rows, the second one combines their masks and counts the lights of each tile, and the third one, after the offsets of the tiles have been computed, writes the indices of the lights of each tile in a single compact array. The result (lights in view coordinates, offset and count of each tile, indices) is ready to be uploaded in texture buffers and read in the fragment shader (see 14_illumination_models_ML_TX.frag):
+- lights: 2 texels for each light (position in view coordinates and radius, color and intensity)
+- tiles: 2 integers for each tile (offset and number of its lights in the indices), tiles ordered by rows, from the bottom of the screen (as gl_FragCoord)
+- indices: 16 bit indices of the lights
+
+The contribution of a light falls smoothly to 0 at its radius (window (1 - (d / r)^4)^2), so the lights outside the range of a fragment can be skipped without visible seams between the tiles.
+
+N.B.) the lights are not culled in depth (the tiles are not split along the z-axis, as in clustered shading): a tile with objects at different depths receives all the lights along its frustum
+N.B.) the indices are 16 bit integers, so at most 65536 lights are supported
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <utils/culling.h>
+#include <utils/jobs.h>
+
+/////////////////// POINTLIGHT struct ///////////////////////
+struct PointLight
+{
+    glm::vec3 position;
+    // distance at which the contribution of the light falls to 0
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+
+/////////////////// LIGHTTILER class ///////////////////////
+class LightTiler
+{
+public:
+    // threads used for the assignment of the lights (NULL to assign them on the calling thread)
+    JobSystem* jobs;
+    // size of the tiles (in pixels), and number of tiles on the x-axis and on the y-axis
+    int tileSize;
+    int tilesX, tilesY;
+    // number of lights of the last assignment
+    int numLights;
+
+    // lights in view coordinates, offset and count of the lights of each tile, and indices of the lights of all the tiles
+    std::vector<PointLight> viewLights;
+    std::vector<uint32_t> tileRanges;
+    std::vector<uint16_t> lightIndices;
+
+    // largest number of lights of a tile, and CPU time (in milliseconds) of the last assignment
+    int maxTileLights;
+    double cullTime;
+
+    // maximum number of lights
+    static const int maxLights = 65536;
+    // minimum number of tiles processed by a job
+    static const int minParallelTiles = 16;
+
+    LightTiler(int tileSize = 32) : jobs(NULL), tileSize(tileSize), tilesX(0), tilesY(0), numLights(0), maxTileLights(0), cullTime(0.0)
+    {}
+
+    //////////////////////////////////////////
+    // We assign n lights (in world coordinates, at most maxLights) to the tiles of a screen of width x height pixels, for the view and projection matrices
+    void Cull(const PointLight* lights, int n, const glm::mat4 &view, const glm::mat4 &projection, int width, int height)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        if (n > maxLights)
+            n = maxLights;
+        this->numLights = n;
+        this->tilesX = (width + this->tileSize - 1) / this->tileSize;
+        this->tilesY = (height + this->tileSize - 1) / this->tileSize;
+        int tiles = this->tilesX * this->tilesY;
+        this->groups = (n + 3) / 4;
+
+        // the lights are transformed in view coordinates (the spheres are padded to a multiple of 4, with spheres which are never visible)
+        this->viewLights.resize(n);
+        this->centerX.assign(4 * this->groups, 0.0f);
+        this->centerY.assign(4 * this->groups, 0.0f);
+        this->centerZ.assign(4 * this->groups, 0.0f);
+        this->radius.assign(4 * this->groups, -1e30f);
+        for (int i = 0; i < n; i++)
+        {
+            this->viewLights[i] = lights[i];
+            this->viewLights[i].position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            this->centerX[i] = this->viewLights[i].position.x;
+            this->centerY[i] = this->viewLights[i].position.y;
+            this->centerZ[i] = this->viewLights[i].position.z;
+            this->radius[i] = lights[i].radius;
+        }
+
+        // first pass: a bit for each light not outside the planes of a column (left, right) or of a row (bottom, top, near, far) of tiles
+        this->lineMasks.resize((size_t)(this->tilesX + this->tilesY) * this->groups);
+        this->Run(this->tilesX + this->tilesY, [this, &projection, width, height](int b, int e)
+        {
+            this->TestLines(projection, width, height, b, e);
+        });
+
+        // second pass: a bit for each light touching a tile, and number of lights of each tile
+        this->masks.resize((size_t)tiles * this->groups);
+        this->counts.resize(tiles);
+        this->Run(tiles, [this](int b, int e)
+        {
+            this->CombineTiles(b, e);
+        });
+
+        // offsets of the tiles in the compact array of the indices
+        this->tileRanges.resize(2 * tiles);
+        uint32_t offset = 0;
+        this->maxTileLights = 0;
+        for (int t = 0; t < tiles; t++)
+        {
+            this->tileRanges[2 * t] = offset;
+            this->tileRanges[2 * t + 1] = (uint32_t)this->counts[t];
+            offset += (uint32_t)this->counts[t];
+            this->maxTileLights = glm::max(this->maxTileLights, this->counts[t]);
+        }
+
+        // third pass: the indices of the lights of each tile, in their original order
+        this->lightIndices.resize(offset);
+        this->Run(tiles, [this](int b, int e)
+        {
+            this->WriteIndices(b, e);
+        });
+
+        this->cullTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //////////////////////////////////////////
+    // We return the frustum of a tile, from the projection matrix: the clip space is scaled and translated so that the tile covers [-1, 1] on the x and y axes
+    Frustum TileFrustum(const glm::mat4 &projection, int width, int height, int tileX, int tileY) const
+    {
+        // bounds of the tile in normalized device coordinates
+        glm::vec2 tileMin = glm::vec2(-1.0f) + 2.0f * glm::vec2((float)(tileX * this->tileSize) / width, (float)(tileY * this->tileSize) / height);
+        glm::vec2 tileMax = glm::vec2(-1.0f) + 2.0f * glm::vec2(glm::min((float)((tileX + 1) * this->tileSize) / width, 1.0f), glm::min((float)((tileY + 1) * this->tileSize) / height, 1.0f));
+        glm::vec2 scale = 2.0f / (tileMax - tileMin);
+        glm::vec2 center = 0.5f * (tileMin + tileMax);
+        // in clip coordinates, x' = scale * (x - center * w) (the same on the y-axis): rows 0 and 1 of the matrix are changed, using row 3 (w)
+        // (the GLM matrices are stored by columns: clip[column][row])
+        glm::mat4 clip = projection;
+        for (int c = 0; c < 4; c++)
+        {
+            clip[c][0] = scale.x * (projection[c][0] - center.x * projection[c][3]);
+            clip[c][1] = scale.y * (projection[c][1] - center.y * projection[c][3]);
+        }
+        return Frustum(clip);
+    }
+
+private:
+    // number of groups of 4 lights
+    int groups;
+    // spheres of the lights in view coordinates (structure of arrays, padded to a multiple of 4)
+    std::vector<float> centerX, centerY, centerZ, radius;
+    // for each column and then for each row of tiles, a bit for each light not outside its planes (groups bytes for each line)
+    std::vector<unsigned char> lineMasks;
+    // for each tile, a bit for each light touching it (groups bytes for each tile), and number of lights
+    std::vector<unsigned char> masks;
+    std::vector<int> counts;
+
+    //////////////////////////////////////////
+    // We process the tiles on the calling thread or on the job system
+    void Run(int tiles, const JobSystem::RangeFunction &body)
+    {
+        if (this->jobs == NULL)
+            body(0, tiles);
+        else
+            this->jobs->ParallelFor(0, tiles, minParallelTiles, JobSystem::cacheLineFloats, body);
+    }
+
+    //////////////////////////////////////////
+    // We test all the lights against the planes of the lines (columns from 0 to tilesX - 1, then rows) from begin to end
+    void TestLines(const glm::mat4 &projection, int width, int height, int begin, int end)
+    {
+        for (int l = begin; l < end; l++)
+        {
+            bool column = (l < this->tilesX);
+            // planes of the frustum of the first tile of the line: left and right for a column, bottom, top, near and far for a row
+            Frustum frustum = column ? this->TileFrustum(projection, width, height, l, 0) : this->TileFrustum(projection, width, height, 0, l - this->tilesX);
+            int firstPlane = column ? 0 : 2, endPlane = column ? 2 : 6;
+            unsigned char* lineMasks = &this->lineMasks[(size_t)l * this->groups];
+            for (int g = 0; g < this->groups; g++)
+            {
+                int i = 4 * g;
+                lineMasks[g] = frustum.AreSpheresVisible(&this->centerX[i], &this->centerY[i], &this->centerZ[i], &this->radius[i], firstPlane, endPlane);
+            }
+        }
+    }
+
+    //////////////////////////////////////////
+    // We combine the masks of the column and of the row of the tiles from begin to end, and we count their lights
+    void CombineTiles(int begin, int end)
+    {
+        // number of bits set in 4 bits
+        static const int bitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+        for (int t = begin; t < end; t++)
+        {
+            const unsigned char* columnMasks = &this->lineMasks[(size_t)(t % this->tilesX) * this->groups];
+            const unsigned char* rowMasks = &this->lineMasks[(size_t)(this->tilesX + t / this->tilesX) * this->groups];
+            unsigned char* tileMasks = &this->masks[(size_t)t * this->groups];
+            int count = 0;
+            for (int g = 0; g < this->groups; g++)
+            {
+                tileMasks[g] = columnMasks[g] & rowMasks[g];
+                count += bitCount[tileMasks[g]];
+            }
+            this->counts[t] = count;
+        }
+    }
+
+    //////////////////////////////////////////
+    // We copy the indices of the lights of the tiles from begin to end, at the offsets of the tiles
+    void WriteIndices(int begin, int end)
+    {
+        for (int t = begin; t < end; t++)
+        {
+            const unsigned char* tileMasks = &this->masks[(size_t)t * this->groups];
+            uint16_t* indices = this->lightIndices.data() + this->tileRanges[2 * t];
+            for (int g = 0; g < this->groups; g++)
+            {
+                unsigned char mask = tileMasks[g];
+                for (int lane = 0; mask != 0; lane++, mask >>= 1)
+                    if (mask & 1)
+                        *indices++ = (uint16_t)(4 * g + lane);
+            }
+        }
+    }
+};
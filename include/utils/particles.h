@@ -0,0 +1,493 @@
+/*
+Particles:
+- ParticleStore class: data of the particles emitted by the objects of the scene, as a structure of arrays
+- ParticleSystem class: simulation of the particles, as a separate stage of the frame, and their preparation for the rendering
+
+During the frame, the objects of the scene only request the spawn of new particles (ParticleSystem::Spawn); then, the ParticleSystem::Update stage creates all the requested particles and updates each particle exactly once, so its cost is linear in the number of particles, and it does not depend on the number of the objects.
+
+Each attribute of the particles (position, speed and color components, life) is stored in a separate array, aligned to 32 bytes and padded to a multiple of 8 elements: in this way, the update kernel (IntegrateParticles) processes 4 particles at a time with SSE instructions (NEON instructions on ARM processors, e.g. Apple Silicon), without a scalar tail. When neither of them is available, a scalar version of the same kernel is used.
+
+All the particles live for the same time (1 second), so they die in the same order in which they are born: the alive particles are kept in a ring buffer, from the oldest to the newest. A new particle is added after the newest one, and the dead particles are removed from the oldest side after the update, so both the spawn and the kill of a particle take constant time, and the update only touches the alive particles.
+When the budget of particles (particleNum) is full, the saturation policy decides what happens to a new particle: it is dropped, it takes the place of the oldest one, or the budget grows. The dropped and the stolen particles are counted.
+The budget can be changed at runtime (ParticleSystem::SetBudget): when it grows beyond the capacity of the store, the store is reallocated with (at least) twice its capacity, and the alive particles are copied at its beginning; when it shrinks, the oldest particles in excess die immediately, and the store keeps its capacity, so dialing the budget up and down does not reallocate it again.
+
+The objects emit the particles through a ParticleEmitter: it emits a number of particles per second (independently of the frame rate), only when the object moves faster than a threshold. The total emission of all the emitters is capped (ParticleSystem::maxEmissionRate): when the emitters request more particles, all of them are slowed down in proportion (from the requests of the previous frame), and the particles emitted in a frame never exceed the cap multiplied by the frame time, so the load of the particles remains stable also with thousands of objects.
+
+If a JobSystem is set (see utils/jobs.h), the update of large numbers of particles is split among its threads, in chunks aligned to the cache lines of the arrays: each particle is updated in the same way by any thread, so the result does not depend on the number of threads.
+
+The alive particles are copied, at each frame, in a single vertex array with interleaved position and color (ParticleVertex), which is uploaded in a VBO and drawn with a single GL_POINTS draw call (see particle.vert and particle.frag).
+
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <utils/jobs.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define PARTICLES_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PARTICLES_NEON
+#endif
+
+// a vertex of the particles VBO: position and color of a particle, interleaved
+// (location 0 and 1 in particle.vert)
+struct ParticleVertex {
+    glm::vec3 Position;
+    glm::vec4 Color;
+};
+
+// a request of a new particle, collected during the frame and processed by ParticleSystem::Update
+struct ParticleSpawn {
+    glm::vec3 Position;
+    glm::vec3 Speed;
+    glm::vec4 Color;
+};
+
+/////////////////// PARTICLESTORE class ///////////////////////
+class ParticleStore
+{
+public:
+    // alignment of the arrays (in bytes), and number of floats in an aligned block
+    static const int alignment = 32;
+    static const int lanes = alignment / sizeof(float);
+
+    // attributes of the particles, one array for each component
+    float *posX, *posY, *posZ;          // initialization position will be equal to the objects (pins and balls)
+    float *speedX, *speedY, *speedZ;    // will be equal to the objects (pins and balls)
+    float *colorR, *colorG, *colorB, *colorA;   // will be green or white to distinguish better
+    float *life;                        // each particle dies in a short time just after rendering
+
+    // number of particles in the arrays (multiple of lanes)
+    int capacity;
+
+    ParticleStore() : capacity(0), block(NULL)
+    {
+        this->SetArrays();
+    }
+
+    ~ParticleStore() { this->Free(); }
+
+    //////////////////////////////////////////
+    // We allocate the arrays for n particles (rounded up to a multiple of lanes): all the particles are created dead
+    // all the arrays are in a single allocation
+    void Allocate(int n)
+    {
+        this->Free();
+        this->capacity = ((n + lanes - 1) / lanes) * lanes;
+        if (this->capacity == 0)
+            return;
+        size_t bytes = (size_t)numArrays * this->capacity * sizeof(float);
+        this->block = (char*)malloc(bytes + alignment);
+        memset(this->block, 0, bytes + alignment);
+        this->SetArrays();
+    }
+
+    //////////////////////////////////////////
+    // We copy n particles of another store, from the index srcBegin, in this store, from the index dstBegin
+    void CopyRange(const ParticleStore &src, int srcBegin, int dstBegin, int n)
+    {
+        for (int a = 0; a < numArrays; a++)
+            memcpy(this->Array(a) + dstBegin, src.Array(a) + srcBegin, n * sizeof(float));
+    }
+
+    //////////////////////////////////////////
+    // We exchange the arrays of two stores (no copy of the data)
+    void Swap(ParticleStore &other)
+    {
+        char* block = this->block;
+        int capacity = this->capacity;
+        this->block = other.block;
+        this->capacity = other.capacity;
+        other.block = block;
+        other.capacity = capacity;
+        this->SetArrays();
+        other.SetArrays();
+    }
+
+    //////////////////////////////////////////
+    // We release the arrays
+    void Free()
+    {
+        free(this->block);
+        this->block = NULL;
+        this->capacity = 0;
+        this->SetArrays();
+    }
+
+private:
+    // number of arrays of the store
+    static const int numArrays = 11;
+    // the allocated memory (not aligned)
+    char* block;
+
+    // the arrays are consecutive in the allocated block, in the same order of SetArrays
+    float* Array(int a) const { return this->posX + (size_t)a * this->capacity; }
+
+    //////////////////////////////////////////
+    // We set the pointers of the arrays inside the allocated block, starting from the first aligned address
+    void SetArrays()
+    {
+        float* base = NULL;
+        if (this->block)
+            base = (float*)(((size_t)this->block + alignment - 1) & ~(size_t)(alignment - 1));
+        float** arrays[numArrays] = {&posX, &posY, &posZ, &speedX, &speedY, &speedZ, &colorR, &colorG, &colorB, &colorA, &life};
+        for (int a = 0; a < numArrays; a++)
+            *arrays[a] = base ? base + (size_t)a * this->capacity : NULL;
+    }
+
+    // the store owns its memory, so it cannot be copied
+    ParticleStore(const ParticleStore&);
+    ParticleStore& operator=(const ParticleStore&);
+};
+
+//////////////////////////////////////////
+// We update the particles of the store from begin to end (both multiple of 4, the number of particles processed together): the lifetime is reduced,
+// and the alive particles move and fade (the particles dying in this update are left as they are)
+inline void IntegrateParticles(ParticleStore &store, int begin, int end, float deltaTime)
+{
+    const float fade = deltaTime * 2.5f;
+#ifdef PARTICLES_SSE
+    const __m128 dt = _mm_set1_ps(deltaTime);
+    const __m128 fadeStep = _mm_set1_ps(fade);
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = begin; i < end; i += 4)
+    {
+        // reduce the lifetime, and we select the alive particles
+        __m128 life = _mm_sub_ps(_mm_load_ps(store.life + i), dt);
+        _mm_store_ps(store.life + i, life);
+        __m128 alive = _mm_cmpgt_ps(life, zero);
+
+        // the position moves against the speed, and the alpha fades, only for the alive particles
+        __m128 dx = _mm_and_ps(alive, _mm_mul_ps(_mm_load_ps(store.speedX + i), dt));
+        __m128 dy = _mm_and_ps(alive, _mm_mul_ps(_mm_load_ps(store.speedY + i), dt));
+        __m128 dz = _mm_and_ps(alive, _mm_mul_ps(_mm_load_ps(store.speedZ + i), dt));
+        _mm_store_ps(store.posX + i, _mm_sub_ps(_mm_load_ps(store.posX + i), dx));
+        _mm_store_ps(store.posY + i, _mm_sub_ps(_mm_load_ps(store.posY + i), dy));
+        _mm_store_ps(store.posZ + i, _mm_sub_ps(_mm_load_ps(store.posZ + i), dz));
+        _mm_store_ps(store.colorA + i, _mm_sub_ps(_mm_load_ps(store.colorA + i), _mm_and_ps(alive, fadeStep)));
+    }
+#elif defined(PARTICLES_NEON)
+    const float32x4_t dt = vdupq_n_f32(deltaTime);
+    const uint32x4_t fadeStep = vreinterpretq_u32_f32(vdupq_n_f32(fade));
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    for (int i = begin; i < end; i += 4)
+    {
+        // reduce the lifetime, and we select the alive particles
+        float32x4_t life = vsubq_f32(vld1q_f32(store.life + i), dt);
+        vst1q_f32(store.life + i, life);
+        uint32x4_t alive = vcgtq_f32(life, zero);
+
+        // the position moves against the speed, and the alpha fades, only for the alive particles
+        float32x4_t dx = vreinterpretq_f32_u32(vandq_u32(alive, vreinterpretq_u32_f32(vmulq_f32(vld1q_f32(store.speedX + i), dt))));
+        float32x4_t dy = vreinterpretq_f32_u32(vandq_u32(alive, vreinterpretq_u32_f32(vmulq_f32(vld1q_f32(store.speedY + i), dt))));
+        float32x4_t dz = vreinterpretq_f32_u32(vandq_u32(alive, vreinterpretq_u32_f32(vmulq_f32(vld1q_f32(store.speedZ + i), dt))));
+        vst1q_f32(store.posX + i, vsubq_f32(vld1q_f32(store.posX + i), dx));
+        vst1q_f32(store.posY + i, vsubq_f32(vld1q_f32(store.posY + i), dy));
+        vst1q_f32(store.posZ + i, vsubq_f32(vld1q_f32(store.posZ + i), dz));
+        vst1q_f32(store.colorA + i, vsubq_f32(vld1q_f32(store.colorA + i), vreinterpretq_f32_u32(vandq_u32(alive, fadeStep))));
+    }
+#else
+    for (int i = begin; i < end; i++)
+    {
+        float life = store.life[i] - deltaTime;
+        store.life[i] = life;
+        // 1 for the alive particles, 0 for the dead ones (no branches)
+        float alive = (life > 0.0f) ? 1.0f : 0.0f;
+        store.posX[i] -= alive * store.speedX[i] * deltaTime;
+        store.posY[i] -= alive * store.speedY[i] * deltaTime;
+        store.posZ[i] -= alive * store.speedZ[i] * deltaTime;
+        store.colorA[i] -= alive * fade;
+    }
+#endif
+}
+
+// an emitter of particles, associated to an object of the scene
+struct ParticleEmitter {
+    float rate;             // particles emitted per second
+    float minSpeed;         // the emitter is active only when the object is faster than this speed
+    float accumulator;      // particles to emit, not emitted yet (fraction)
+    bool  active;           // the emitter has emitted in the last frame
+
+    ParticleEmitter(float rate = 0.0f, float minSpeed = 0.0f) : rate(rate), minSpeed(minSpeed), accumulator(0.0f), active(false)
+    {}
+};
+
+// what happens to a new particle when the budget of particles is full
+enum ParticleSaturation {
+    DROP_NEW_PARTICLES,         // the new particle is dropped
+    STEAL_OLDEST_PARTICLES,     // the oldest particle dies, and the new one takes its place
+    GROW_PARTICLES              // the budget is doubled
+};
+
+/////////////////// PARTICLESYSTEM class ///////////////////////
+class ParticleSystem
+{
+public:
+    // all the particles, which will be born and die over and over
+    ParticleStore store;
+    // number of the particles which can be alive at the same time (it can be tweaked with ImGui, through SetBudget)
+    // it is never larger than the capacity of the store
+    int particleNum;
+    // policy applied when particleNum particles are alive
+    ParticleSaturation saturation;
+    // spawn requests of the current frame
+    std::vector<ParticleSpawn> spawnRequests;
+    // CPU time (in milliseconds) of the last update
+    double updateTime;
+    // maximum number of particles emitted per second by all the emitters (0 = the budget: the particles live 1 second, so the alive particles stay within the budget)
+    float maxEmissionRate;
+    // particles per second requested by the active emitters in the last frame, and scale applied to the emitters in this frame to respect the cap
+    float requestedRate;
+    float emissionScale;
+    // threads used for the update (NULL to update the particles on the calling thread)
+    JobSystem* jobs;
+    // minimum number of particles updated by a job
+    static const int minParallelChunk = 16384;
+
+    // number of the new particles dropped, and of the old particles replaced by new ones, because the budget was full
+    unsigned long droppedSpawns;
+    unsigned long stolenSpawns;
+    // number of reallocations of the store
+    unsigned long reallocations;
+
+    //////////////////////////////////////////
+    // constructor: all the particles are created dead
+    ParticleSystem(int maxParticles, ParticleSaturation saturation = STEAL_OLDEST_PARTICLES)
+        : particleNum(maxParticles), saturation(saturation), updateTime(0.0), maxEmissionRate(0.0f), requestedRate(0.0f), emissionScale(1.0f), jobs(NULL), droppedSpawns(0), stolenSpawns(0), reallocations(0), head(0), count(0), pendingRate(0.0f)
+    {
+        // the allowance of the first frame assumes 60 frames per second
+        this->emissionAllowance = maxParticles / 60.0f;
+        this->store.Allocate(maxParticles);
+    }
+
+    // number of alive particles
+    int Count() const { return this->count; }
+
+    //////////////////////////////////////////
+    // We change the budget of particles: the store grows geometrically if needed, and the oldest particles in excess die
+    void SetBudget(int n)
+    {
+        this->particleNum = (n > 0) ? n : 0;
+        if (this->particleNum > this->store.capacity)
+            this->Reserve(2 * this->store.capacity > this->particleNum ? 2 * this->store.capacity : this->particleNum);
+        while (this->count > this->particleNum)
+            this->KillOldest();
+    }
+
+    //////////////////////////////////////////
+    // We advance an emitter by deltaTime, for an object moving at the speed passed as parameter
+    // the function returns the number of particles to emit now (then requested with Spawn)
+    int Emit(ParticleEmitter &emitter, float speed, float deltaTime)
+    {
+        // an object at rest does not emit, and it does not accumulate particles to emit later
+        if (speed <= emitter.minSpeed || emitter.rate <= 0.0f)
+        {
+            emitter.active = false;
+            return 0;
+        }
+        // when an emitter starts, its accumulator starts from a random fraction: in this way, the emitters starting together
+        // (e.g., all the pins hit by a ball) do not emit all in the same frames
+        if (!emitter.active)
+        {
+            emitter.accumulator = (rand() % 1000) / 1000.0f;
+            emitter.active = true;
+        }
+        this->pendingRate += emitter.rate;
+        emitter.accumulator += emitter.rate * this->emissionScale * deltaTime;
+        int n = (int)emitter.accumulator;
+        emitter.accumulator -= n;
+        // the particles over the allowance of the frame are not emitted
+        if (n > (int)this->emissionAllowance)
+            n = (int)this->emissionAllowance;
+        this->emissionAllowance -= n;
+        return n;
+    }
+
+    //////////////////////////////////////////
+    // We request a new particle: it will be created by the next update
+    void Spawn(const glm::vec3 &position, const glm::vec3 &speed, const glm::vec4 &color)
+    {
+        ParticleSpawn request;
+        request.Position = position;
+        request.Speed = speed;
+        request.Color = color;
+        this->spawnRequests.push_back(request);
+    }
+
+    //////////////////////////////////////////
+    // We create the requested particles after the newest one, then we update the alive particles once, and we remove the dead ones
+    void Update(float deltaTime)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the emission requested in this frame sets the scale of the emitters for the next frame
+        float cap = (this->maxEmissionRate > 0.0f) ? this->maxEmissionRate : (float)this->particleNum;
+        this->requestedRate = this->pendingRate;
+        this->emissionScale = (this->requestedRate > cap) ? cap / this->requestedRate : 1.0f;
+        this->pendingRate = 0.0f;
+        // allowance of the next frame (assuming the same frame time), plus the fraction of particle not emitted in this frame
+        this->emissionAllowance = cap * deltaTime + (this->emissionAllowance - (int)this->emissionAllowance);
+
+        // add new particles
+        for (size_t r = 0; r < this->spawnRequests.size(); r++)
+        {
+            // the budget is full
+            if (this->count >= this->particleNum)
+            {
+                if (this->saturation == GROW_PARTICLES)
+                    this->SetBudget((this->particleNum > 0) ? 2 * this->particleNum : 1);
+                else if (this->saturation == STEAL_OLDEST_PARTICLES && this->particleNum > 0)
+                {
+                    while (this->count >= this->particleNum)
+                        this->KillOldest();
+                    this->stolenSpawns++;
+                }
+                else
+                {
+                    this->droppedSpawns++;
+                    continue;
+                }
+            }
+
+            const ParticleSpawn &request = this->spawnRequests[r];
+            int i = this->Slot(this->count);
+            this->store.posX[i] = request.Position.x;
+            this->store.posY[i] = request.Position.y;
+            this->store.posZ[i] = request.Position.z;
+            this->store.speedX[i] = request.Speed.x;
+            this->store.speedY[i] = request.Speed.y;
+            this->store.speedZ[i] = request.Speed.z;
+            this->store.colorR[i] = request.Color.r;
+            this->store.colorG[i] = request.Color.g;
+            this->store.colorB[i] = request.Color.b;
+            this->store.colorA[i] = request.Color.a;
+            this->store.life[i] = 1.0f;
+            this->count++;
+        }
+        this->spawnRequests.clear();
+
+        // update the alive particles: one or two ranges of the ring, extended to multiples of 4
+        // (the slots added at the ends are dead, so the update does not change them)
+        if (this->count > 0)
+        {
+            int begin = this->head & ~3;
+            int tail = this->head + this->count;
+            if (tail <= this->store.capacity)
+                this->Integrate(begin, (tail + 3) & ~3, deltaTime);
+            else
+            {
+                tail = (tail - this->store.capacity + 3) & ~3;
+                // the two ranges must not overlap, otherwise a particle would be updated twice
+                if (tail <= begin)
+                {
+                    this->Integrate(begin, this->store.capacity, deltaTime);
+                    this->Integrate(0, tail, deltaTime);
+                }
+                else
+                    this->Integrate(0, this->store.capacity, deltaTime);
+            }
+        }
+
+        // the oldest particles are the first to die
+        while (this->count > 0 && this->store.life[this->head] <= 0.0f)
+            this->KillOldest();
+
+        this->updateTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //////////////////////////////////////////
+    // We copy the position and the color of the alive particles in the vertex array, which is then uploaded in the VBO
+    // the vertex array is never shrunk, so after the first frames it is not reallocated anymore
+    // the function returns the number of alive particles (= vertices to draw)
+    size_t Pack(std::vector<ParticleVertex> &vertices) const
+    {
+        const ParticleStore &s = this->store;
+        if (vertices.size() < (size_t)this->count)
+            vertices.resize(this->count);
+
+        size_t alive = 0;
+        for (int k = 0; k < this->count; k++)
+        {
+            int i = this->Slot(k);
+            if (s.life[i] > 0.0f)
+            {
+                vertices[alive].Position = glm::vec3(s.posX[i], s.posY[i], s.posZ[i]);
+                vertices[alive].Color = glm::vec4(s.colorR[i], s.colorG[i], s.colorB[i], s.colorA[i]);
+                alive++;
+            }
+        }
+        return alive;
+    }
+
+    //////////////////////////////////////////
+    // We enlarge the store to at least n particles: the alive particles are copied at the beginning of the new store, from the oldest one
+    void Reserve(int n)
+    {
+        if (n <= this->store.capacity)
+            return;
+        ParticleStore grown;
+        grown.Allocate(n);
+        // the ring can be split in two ranges: from the oldest particle to the end of the store, and from the beginning of the store
+        int first = this->store.capacity - this->head;
+        if (first > this->count)
+            first = this->count;
+        grown.CopyRange(this->store, this->head, 0, first);
+        grown.CopyRange(this->store, 0, first, this->count - first);
+        this->store.Swap(grown);
+        this->head = 0;
+        this->reallocations++;
+    }
+
+private:
+    // slot of the oldest alive particle, and number of alive particles
+    int head;
+    int count;
+    // particles per second requested by the active emitters in the current frame
+    float pendingRate;
+    // particles which can still be emitted in the current frame
+    float emissionAllowance;
+
+    //////////////////////////////////////////
+    // We update the particles from begin to end, on the threads of the job system if it is set
+    void Integrate(int begin, int end, float deltaTime)
+    {
+        if (this->jobs == NULL)
+        {
+            IntegrateParticles(this->store, begin, end, deltaTime);
+            return;
+        }
+        ParticleStore &store = this->store;
+        this->jobs->ParallelFor(begin, end, minParallelChunk, JobSystem::cacheLineFloats, [&store, deltaTime](int b, int e)
+        {
+            IntegrateParticles(store, b, e, deltaTime);
+        });
+    }
+
+    // slot of the k-th alive particle, from the oldest one
+    int Slot(int k) const
+    {
+        int i = this->head + k;
+        return (i >= this->store.capacity) ? i - this->store.capacity : i;
+    }
+
+    //////////////////////////////////////////
+    // We remove the oldest particle (its slot is marked as dead, because it could be still alive if it has been stolen)
+    void KillOldest()
+    {
+        this->store.life[this->head] = 0.0f;
+        this->head = this->Slot(1);
+        this->count--;
+        if (this->count == 0)
+            this->head = 0;
+    }
+};
@@ -2,9 +2,16 @@
 Physics class:
 - initialization of the physics simulation using the Bullet library
 
-The class sets up the collision manager and the resolver of the constraints, using basic general-purposes methods provided by the library. Advanced and multithread methods are available, please consult Bullet documentation and examples
+The class sets up the collision manager and the resolver of the constraints, using basic general-purposes methods provided by the library.
+If a number of threads is passed to the constructor, the multithread versions are used instead (parallel collision dispatcher, pool of constraint solvers, and multithread simulation island manager), backed by the default Bullet task scheduler. N.B.) the Bullet libraries must be compiled with BT_THREADSAFE, otherwise the sequential version is used
 
 createRigidBody method sets up a Box or Sphere Collision Shape. For other Shapes, you must extend the method.
+Collision Shapes are immutable and can be shared among rigid bodies: they are cached by type and size, so that all the bodies with the same shape (e.g., all the pins, or all the balls) use a single instance.
+Rigid bodies and their Motion States are allocated in the slots of a pool (RigidBodyPool class): releaseRigidBody method returns the slot to the pool, and the next created body reuses it without any new allocation on the heap.
+The bodies fallen out of the scene are retired after the step of the simulation: CollectOutOfBounds method finds them, and FlushRetired method removes them from the dynamics world all together and returns their storage to the pool.
+
+Step method advances the simulation with a fixed time step, independently of the frame rate: the frame time is accumulated, and consumed in ticks of fixedTimeStep seconds (at most maxTicksPerFrame for each frame, the remaining time is dropped to avoid a "spiral of death" after a slow frame).
+The transformations used for the rendering are interpolated between the last two ticks (GetInterpolatedTransform method), using the time left in the accumulator.
 
 author: Davide Gadia
 
@@ -16,10 +23,112 @@ Universita' degli Studi di Milano
 #pragma once
 
 #include <bullet/btBulletDynamicsCommon.h>
+// multithread versions of the dynamics world, collision dispatcher and constraint solver
+#include <bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+#include <bullet/LinearMath/btThreads.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
 
 //enum to identify the 2 considered Collision Shapes
 enum shapes{ BOX, SPHERE};
 
+// key of the cache of the Collision Shapes: type and size of the shape
+struct ShapeKey
+{
+    int type;
+    float x, y, z;
+
+    bool operator<(const ShapeKey &other) const
+    {
+        if (type != other.type) return type < other.type;
+        if (x != other.x) return x < other.x;
+        if (y != other.y) return y < other.y;
+        return z < other.z;
+    }
+};
+
+///////////////////  InterpolatedMotionState class ///////////////////////
+// Motion State which keeps also the transformation of the rigid body at the previous tick of the simulation,
+// in order to interpolate the transformation used for the rendering between the last two ticks
+class InterpolatedMotionState : public btDefaultMotionState
+{
+public:
+    btTransform previousTransform;
+
+    InterpolatedMotionState(const btTransform& startTrans) : btDefaultMotionState(startTrans), previousTransform(startTrans)
+    {}
+};
+
+///////////////////  RigidBodyPool class ///////////////////////
+// pool of slots, each one with the storage for a rigid body and its Motion State
+// the slots are allocated in blocks of slotsPerBlock, and the released slots are kept in a free list to be reused
+// in this way, after the first blocks, the creation of new bodies does not allocate memory on the heap
+class RigidBodyPool
+{
+public:
+    btAlignedObjectArray<char*> blocks; // blocks of slots allocated from the heap
+    btAlignedObjectArray<void*> freeSlots; // released slots, ready to be reused
+    int slotsPerBlock; // number of slots allocated together
+    size_t bodySize; // size of the part of the slot for the rigid body (the Motion State follows)
+    size_t slotSize; // size of a slot (rigid body + Motion State), aligned to 16 bytes
+    int slotsInUse; // number of slots currently used by rigid bodies
+    int peakSlotsInUse; // maximum number of slots used at the same time
+
+    RigidBodyPool(int slotsPerBlock = 64) : slotsPerBlock(slotsPerBlock), slotsInUse(0), peakSlotsInUse(0)
+    {
+        this->bodySize = (sizeof(btRigidBody) + 15) & ~size_t(15);
+        this->slotSize = this->bodySize + ((sizeof(InterpolatedMotionState) + 15) & ~size_t(15));
+    }
+
+    //////////////////////////////////////////
+    // We take a free slot (a new block is allocated only if all the slots are in use)
+    void* Acquire()
+    {
+        if (this->freeSlots.size() == 0)
+        {
+            char* block = (char*)btAlignedAlloc(this->slotSize * this->slotsPerBlock, 16);
+            this->blocks.push_back(block);
+            // the slots of the block are pushed in reverse order, so that they are taken in order of address
+            for (int i = this->slotsPerBlock - 1; i >= 0; i--)
+                this->freeSlots.push_back(block + i * this->slotSize);
+        }
+
+        void* slot = this->freeSlots[this->freeSlots.size() - 1];
+        this->freeSlots.pop_back();
+
+        this->slotsInUse++;
+        if (this->slotsInUse > this->peakSlotsInUse)
+            this->peakSlotsInUse = this->slotsInUse;
+        return slot;
+    }
+
+    //////////////////////////////////////////
+    // We return the slot to the free list (the objects inside must be already destroyed)
+    void Release(void* slot)
+    {
+        this->freeSlots.push_back(slot);
+        this->slotsInUse--;
+    }
+
+    // the Motion State is placed after the rigid body, in the same slot
+    void* MotionStateStorage(void* slot) { return (char*)slot + this->bodySize; }
+
+    //////////////////////////////////////////
+    // We free all the blocks (all the slots must be already released)
+    void Clear()
+    {
+        for (int i = 0; i < this->blocks.size(); i++)
+            btAlignedFree(this->blocks[i]);
+        this->blocks.clear();
+        this->freeSlots.clear();
+        this->slotsInUse = 0;
+    }
+};
+
 ///////////////////  Physics class ///////////////////////
 class Physics
 {
@@ -27,33 +136,93 @@ public:
 
     btDiscreteDynamicsWorld* dynamicsWorld; // the main physical simulation class
     btAlignedObjectArray<btCollisionShape*> collisionShapes; // a vector for all the Collision Shapes of the scene
+    std::map<ShapeKey, btCollisionShape*> shapeCache; // Collision Shapes shared among the rigid bodies, by type and size
+    RigidBodyPool bodyPool; // storage of the rigid bodies and of their Motion States
+    btAlignedObjectArray<btRigidBody*> retiredBodies; // bodies out of the scene, waiting to be removed from the dynamics world
+    unsigned long totalRetired; // bodies retired from the beginning
     btDefaultCollisionConfiguration* collisionConfiguration; // setup for the collision manager
     btCollisionDispatcher* dispatcher; // collision manager
     btBroadphaseInterface* overlappingPairCache; // method for the broadphase collision detection
-    btSequentialImpulseConstraintSolver* solver; // constraints solver
+    btConstraintSolver* solver; // constraints solver (a pool of solvers in the multithread version)
+    btITaskScheduler* taskScheduler; // task scheduler for the multithread version (NULL in the sequential one)
+    int numThreads; // number of threads used by the simulation
+
+    btScalar fixedTimeStep; // duration of a tick of the simulation
+    int maxTicksPerFrame; // maximum number of ticks simulated in a single frame
+    btScalar accumulator; // frame time not yet simulated
+    btScalar interpolationAlpha; // position between the last two ticks of the transformations used for the rendering (0 = previous tick, 1 = last tick)
+
+    // counters of the Step method
+    int ticksLastFrame; // ticks simulated in the last frame
+    double stepTimeLastFrame; // milliseconds spent in the simulation in the last frame
+    unsigned long totalTicks; // ticks simulated from the beginning
+    unsigned long droppedTicks; // ticks dropped because over the maxTicksPerFrame limit
 
 
     //////////////////////////////////////////
     // constructor
     // we set all the classes needed for the physical simulation
-    Physics()
+    // with threads > 0, the multithread versions of the classes are used, with the given number of worker threads
+    Physics(int threads = 0)
     {
+        this->taskScheduler = NULL;
+        this->numThreads = 1;
+
+        // the simulation runs at 60 ticks per second, and it can catch up to 4 ticks in a single frame
+        this->fixedTimeStep = 1.0f / 60.0f;
+        this->maxTicksPerFrame = 4;
+        this->accumulator = 0.0f;
+        this->interpolationAlpha = 1.0f;
+        this->ticksLastFrame = 0;
+        this->stepTimeLastFrame = 0.0;
+        this->totalTicks = 0;
+        this->droppedTicks = 0;
+        this->totalRetired = 0;
+
+        // we create the default task scheduler (Win32 or pthreads based). It is NULL if Bullet has not been compiled with BT_THREADSAFE
+        if (threads > 0)
+        {
+            this->taskScheduler = btCreateDefaultTaskScheduler();
+            if (this->taskScheduler == NULL)
+                std::cout << "Bullet task scheduler not available (BT_THREADSAFE not defined), using the sequential simulation" << std::endl;
+        }
+
         // Collision configuration, to be used by the collision detection class
         // collision configuration contains default setup for memory, collision setup. Advanced users can create their own configuration.
         this->collisionConfiguration = new btDefaultCollisionConfiguration();
 
-        // default collision dispatcher (=collision detection method). For parallel processing you can use a diffent dispatcher (see Extras/BulletMultiThreaded)
-        this->dispatcher = new btCollisionDispatcher(this->collisionConfiguration);
-
         // btDbvtBroadphase is a good general purpose broadphase. You can also try out btAxis3Sweep.
         this->overlappingPairCache = new btDbvtBroadphase();
 
-        // we set a ODE solver, which considers forces, constraints, collisions etc., to calculate positions and rotations of the rigid bodies.
-        // the default constraint solver. For parallel processing you can use a different solver (see Extras/BulletMultiThreaded)
-        this->solver = new btSequentialImpulseConstraintSolver();
+        if (this->taskScheduler)
+        {
+            // the task scheduler must be set before the creation of the multithread classes
+            this->taskScheduler->setNumThreads(btMin(threads, this->taskScheduler->getMaxNumThreads()));
+            btSetTaskScheduler(this->taskScheduler);
+            this->numThreads = this->taskScheduler->getNumThreads();
+
+            // the narrowphase of the pairs found by the broadphase is processed in parallel
+            this->dispatcher = new btCollisionDispatcherMt(this->collisionConfiguration);
 
-        //  DynamicsWorld is the main class for the physical simulation
-        this->dynamicsWorld = new btDiscreteDynamicsWorld(this->dispatcher,this->overlappingPairCache,this->solver,this->collisionConfiguration);
+            // a pool of constraint solvers (one for each thread): the simulation islands are solved in parallel
+            btConstraintSolverPoolMt* solverPool = new btConstraintSolverPoolMt(this->numThreads);
+            this->solver = solverPool;
+
+            // the multithread DynamicsWorld uses internally the multithread simulation island manager (btSimulationIslandManagerMt)
+            this->dynamicsWorld = new btDiscreteDynamicsWorldMt(this->dispatcher,this->overlappingPairCache,solverPool,NULL,this->collisionConfiguration);
+        }
+        else
+        {
+            // default collision dispatcher (=collision detection method)
+            this->dispatcher = new btCollisionDispatcher(this->collisionConfiguration);
+
+            // we set a ODE solver, which considers forces, constraints, collisions etc., to calculate positions and rotations of the rigid bodies.
+            // the default constraint solver
+            this->solver = new btSequentialImpulseConstraintSolver();
+
+            //  DynamicsWorld is the main class for the physical simulation
+            this->dynamicsWorld = new btDiscreteDynamicsWorld(this->dispatcher,this->overlappingPairCache,this->solver,this->collisionConfiguration);
+        }
 
         // we set the gravity force
         this->dynamicsWorld->setGravity(btVector3(0.0f,-9.82f,0.0f));
@@ -65,8 +234,6 @@ public:
     btRigidBody* createRigidBody(int type, glm::vec3 pos, glm::vec3 size, glm::vec3 rot, float m, float friction , float restitution)
     {
 
-        btCollisionShape* cShape = NULL;
-
         // we convert the glm vector to a Bullet vector
         btVector3 position = btVector3(pos.x,pos.y,pos.z);
 
@@ -74,20 +241,8 @@ public:
         btQuaternion rotation;
         rotation.setEuler(rot.x,rot.y,rot.z);
 
-        // Box Collision shape
-        if (type == BOX)
-        {
-            // we convert the glm vector to a Bullet vector
-            btVector3 dim = btVector3(size.x,size.y,size.z);
-            // BoxShape
-            cShape = new btBoxShape(dim);
-        }
-        // Sphere Collision Shape (in this case we consider only the first component)
-        else if (type == SPHERE)
-            cShape = new btSphereShape(size.x);
-
-        // we add this Collision Shape to the vector
-        this->collisionShapes.push_back(cShape);
+        // we reuse the Collision Shape with the same type and size, if already created
+        btCollisionShape* cShape = this->getCollisionShape(type, size);
 
         // We set the initial transformations
         btTransform objTransform;
@@ -107,7 +262,11 @@ public:
 
         // we initialize the Motion State of the object on the basis of the transformations
         // using the Motion State, the physical simulation will calculate the positions and rotations of the rigid body
-        btDefaultMotionState* motionState = new btDefaultMotionState(objTransform);
+        // we take a slot from the pool, for the storage of the rigid body and of the Motion State
+        void* slot = this->bodyPool.Acquire();
+
+        // the Motion State keeps also the transformation at the previous tick, for the interpolation during the rendering
+        InterpolatedMotionState* motionState = new (this->bodyPool.MotionStateStorage(slot)) InterpolatedMotionState(objTransform);
 
         // we set the data structure for the rigid body
         btRigidBody::btRigidBodyConstructionInfo rbInfo(mass,motionState,cShape,localInertia);
@@ -123,8 +282,8 @@ public:
             rbInfo.m_rollingFriction = 0.3f;
         }
 
-        // we create the rigid body
-        btRigidBody* body = new btRigidBody(rbInfo);
+        // we create the rigid body (in the slot of the pool)
+        btRigidBody* body = new (slot) btRigidBody(rbInfo);
 
         //add the body to the dynamics world
         this->dynamicsWorld->addRigidBody(body);
@@ -134,6 +293,161 @@ public:
         return body;
     }
 
+    //////////////////////////////////////////
+    // We remove the rigid body from the dynamics world, and we return its storage to the pool
+    // the Collision Shape is shared with other bodies, so it is kept in the cache
+    void releaseRigidBody(btRigidBody* body)
+    {
+        this->dynamicsWorld->removeRigidBody(body);
+        this->destroyRigidBody(body);
+    }
+
+    //////////////////////////////////////////
+    // We find the dynamic bodies fallen below minY, and we add them to the retiredBodies vector
+    // they are not removed immediately, in order to allow the application to update its data before FlushRetired is called
+    // the method returns the number of bodies found
+    int CollectOutOfBounds(btScalar minY)
+    {
+        int found = 0;
+        btAlignedObjectArray<btRigidBody*>& bodies = this->dynamicsWorld->getNonStaticRigidBodies();
+        for (int i = 0; i < bodies.size(); i++)
+        {
+            if (bodies[i]->getWorldTransform().getOrigin().getY() < minY)
+            {
+                this->retiredBodies.push_back(bodies[i]);
+                found++;
+            }
+        }
+        return found;
+    }
+
+    //////////////////////////////////////////
+    // We remove the retired bodies from the dynamics world, and we return their storage to the pool
+    void FlushRetired()
+    {
+        for (int i = 0; i < this->retiredBodies.size(); i++)
+            this->releaseRigidBody(this->retiredBodies[i]);
+        this->totalRetired += this->retiredBodies.size();
+        // clear() would free the memory of the vector: we only reset its size, to reuse it at the next frame
+        this->retiredBodies.resizeNoInitialize(0);
+    }
+
+    //////////////////////////////////////////
+    // We retire all the dynamic bodies fallen below minY (CollectOutOfBounds + FlushRetired)
+    int RetireBodiesBelow(btScalar minY)
+    {
+        int found = this->CollectOutOfBounds(minY);
+        this->FlushRetired();
+        return found;
+    }
+
+    //////////////////////////////////////////
+    // We return the Collision Shape with the type and size passed as parameters
+    // the shape is created only the first time, then the same instance is shared by all the rigid bodies
+    btCollisionShape* getCollisionShape(int type, glm::vec3 size)
+    {
+        // for a sphere, only the first component of the size is considered
+        ShapeKey key = { type, size.x, (type == SPHERE) ? 0.0f : size.y, (type == SPHERE) ? 0.0f : size.z };
+
+        std::map<ShapeKey, btCollisionShape*>::iterator cached = this->shapeCache.find(key);
+        if (cached != this->shapeCache.end())
+            return cached->second;
+
+        btCollisionShape* cShape = NULL;
+        // Box Collision shape
+        if (type == BOX)
+        {
+            // we convert the glm vector to a Bullet vector
+            btVector3 dim = btVector3(size.x,size.y,size.z);
+            // BoxShape
+            cShape = new btBoxShape(dim);
+        }
+        // Sphere Collision Shape (in this case we consider only the first component)
+        else if (type == SPHERE)
+            cShape = new btSphereShape(size.x);
+
+        // we add this Collision Shape to the vector and to the cache
+        this->collisionShapes.push_back(cShape);
+        this->shapeCache[key] = cShape;
+
+        return cShape;
+    }
+
+    //////////////////////////////////////////
+    // We print on console the number of Collision Shapes and rigid bodies, and an estimation of the memory they use
+    void PrintMemoryReport()
+    {
+        int numBodies = this->dynamicsWorld->getNumCollisionObjects();
+        size_t shapesMemory = 0;
+        for (int i = 0; i < this->collisionShapes.size(); i++)
+            shapesMemory += (this->collisionShapes[i]->getShapeType() == SPHERE_SHAPE_PROXYTYPE) ? sizeof(btSphereShape) : sizeof(btBoxShape);
+        size_t bodiesMemory = numBodies * (sizeof(btRigidBody) + sizeof(InterpolatedMotionState));
+
+        std::cout << "Collision Shapes: " << this->collisionShapes.size() << " (" << shapesMemory << " bytes)"
+                  << " - Rigid bodies: " << numBodies << " (" << bodiesMemory << " bytes)" << std::endl;
+        std::cout << "Rigid body pool: " << this->bodyPool.slotsInUse << " slots in use (peak " << this->bodyPool.peakSlotsInUse << ") - "
+                  << this->bodyPool.blocks.size() << " blocks (" << this->bodyPool.blocks.size() * this->bodyPool.slotsPerBlock * this->bodyPool.slotSize << " bytes)" << std::endl;
+    }
+
+    //////////////////////////////////////////
+    // We advance the simulation of the time passed from the previous frame, in ticks of fixedTimeStep seconds
+    // the time which is not enough for a tick remains in the accumulator for the next frames
+    // the method returns the number of simulated ticks
+    int Step(btScalar frameTime)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        this->accumulator += frameTime;
+
+        int ticks = 0;
+        while (this->accumulator >= this->fixedTimeStep && ticks < this->maxTicksPerFrame)
+        {
+            // we save the current transformations as the previous ones, before the new tick
+            btAlignedObjectArray<btRigidBody*>& bodies = this->dynamicsWorld->getNonStaticRigidBodies();
+            for (int i = 0; i < bodies.size(); i++)
+                static_cast<InterpolatedMotionState*>(bodies[i]->getMotionState())->previousTransform = bodies[i]->getWorldTransform();
+
+            // a single step of fixed duration (no internal substeps)
+            this->dynamicsWorld->stepSimulation(this->fixedTimeStep, 0);
+            this->accumulator -= this->fixedTimeStep;
+            ticks++;
+        }
+
+        // if the frame was too slow, we drop the time we could not simulate: otherwise the next frames would need even more ticks to catch up ("spiral of death")
+        if (this->accumulator >= this->fixedTimeStep)
+        {
+            btScalar dropped = std::floor(this->accumulator / this->fixedTimeStep);
+            this->droppedTicks += (unsigned long)dropped;
+            this->accumulator -= dropped * this->fixedTimeStep;
+        }
+
+        // the rendering will show the bodies between the previous and the last tick
+        this->interpolationAlpha = this->accumulator / this->fixedTimeStep;
+
+        this->ticksLastFrame = ticks;
+        this->totalTicks += ticks;
+        this->stepTimeLastFrame = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        return ticks;
+    }
+
+    //////////////////////////////////////////
+    // We calculate the transformation of the rigid body to be used for the rendering, interpolating between the previous and the last tick of the simulation
+    void GetInterpolatedTransform(btRigidBody* body, btTransform &transform)
+    {
+        const btTransform &current = body->getWorldTransform();
+        // static bodies never move
+        if (body->isStaticObject())
+        {
+            transform = current;
+            return;
+        }
+
+        const btTransform &previous = static_cast<InterpolatedMotionState*>(body->getMotionState())->previousTransform;
+        transform.setOrigin(previous.getOrigin().lerp(current.getOrigin(), this->interpolationAlpha));
+        transform.setRotation(previous.getRotation().slerp(current.getRotation(), this->interpolationAlpha));
+    }
+
     //////////////////////////////////////////
     // We delete the data of the physical simulation when the program ends
     void Clear()
@@ -145,13 +459,12 @@ public:
             btCollisionObject* obj = this->dynamicsWorld->getCollisionObjectArray()[i];
             // we upcast in order to use the methods of the main class RigidBody
             btRigidBody* body = btRigidBody::upcast(obj);
-            if (body && body->getMotionState())
-            {
-                delete body->getMotionState();
-            }
             this->dynamicsWorld->removeCollisionObject( obj );
-            delete obj;
+            // all the rigid bodies have been created in the slots of the pool
+            this->destroyRigidBody(body);
         }
+        // we free the memory of the pool
+        this->bodyPool.Clear();
 
         //delete dynamics world
         delete this->dynamicsWorld;
@@ -167,6 +480,33 @@ public:
 
         delete this->collisionConfiguration;
 
+        // we delete the Collision Shapes (shared by the rigid bodies, so they are deleted only after all the bodies)
+        for (int i = 0; i < this->collisionShapes.size(); i++)
+            delete this->collisionShapes[i];
+        this->shapeCache.clear();
+
+        // we restore the sequential task scheduler before deleting the multithread one
+        if (this->taskScheduler)
+        {
+            btSetTaskScheduler(btGetSequentialTaskScheduler());
+            delete this->taskScheduler;
+            this->taskScheduler = NULL;
+        }
+
         this->collisionShapes.clear();
     }
+
+private:
+    //////////////////////////////////////////
+    // We destroy the rigid body and its Motion State, and we return their slot to the pool (the body must be already removed from the dynamics world)
+    void destroyRigidBody(btRigidBody* body)
+    {
+        // the rigid body has been created at the beginning of the slot
+        void* slot = body;
+        btMotionState* motionState = body->getMotionState();
+        body->~btRigidBody();
+        if (motionState)
+            motionState->~btMotionState();
+        this->bodyPool.Release(slot);
+    }
 };
@@ -0,0 +1,55 @@
+/*
+CounterRandom class:
+- a counter-based random number generator: the numbers are a hash of (seed, stream, counter)
+
+Each stream (e.g., the index of an instance) has its own independent sequence of numbers, which does not depend on the other streams: the numbers of the instance i are the same whether the instances are generated in order on a thread, or in any order on many threads. So a procedural generation can be split among the threads of a JobSystem (see utils/jobs.h), and its result depends only on the seed.
+The hash is the splitmix64 finalizer (a sequence of multiply-xorshift steps), applied to a 64 bit counter incremented by the golden ratio constant at each number; the counter of each stream starts from a different point, given by the seed and by the index of the stream (mixed with the same finalizer). It needs only 8 bytes of state and a few multiplications for each number, and it passes the usual statistical tests (it is the generator used to seed xoshiro/xorshift generators).
+
+N.B.) the generator is not suitable for cryptography
+N.B.) the header does not use OpenGL, so it can be used also by the headless simulation
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/////////////////// COUNTERRANDOM class ///////////////////////
+class CounterRandom
+{
+public:
+    //////////////////////////////////////////
+    // constructor: the stream of numbers of the index passed as parameter, for a seed
+    CounterRandom(uint32_t seed, uint32_t stream)
+    {
+        this->counter = Mix(((uint64_t)seed << 32) | stream);
+    }
+
+    //////////////////////////////////////////
+    // We return the next 32 bit number of the stream
+    uint32_t Next()
+    {
+        // we keep the high bits of the hash, which are the best mixed
+        this->counter += 0x9E3779B97F4A7C15ULL;
+        return (uint32_t)(Mix(this->counter) >> 32);
+    }
+
+    //////////////////////////////////////////
+    // We return a number in [0, n), with the same distribution of rand() % n
+    int Range(int n) { return (int)(this->Next() % (uint32_t)n); }
+
+    //////////////////////////////////////////
+    // We return a float in [0, 1)
+    float Uniform() { return (this->Next() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+    uint64_t counter;
+
+    //////////////////////////////////////////
+    // splitmix64 finalizer: close values of seed and stream give unrelated starting points
+    static uint64_t Mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+};
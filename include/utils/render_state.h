@@ -0,0 +1,236 @@
+/*
+RenderState class:
+- a cache of the OpenGL state set by the rendering loop: the calls which would not change the state are not sent to the driver
+
+The rendering loop changes the state through the RenderState, which remembers the current value of each piece of state, and calls OpenGL only when the value changes. The calls sent to the driver (issued) and the ones skipped because redundant (elided) are counted for each kind of state, and the counters can be read and reset at each frame.
+Current state:
+- the Shader Program in use (UseProgram)
+- the subroutine uniforms of each Shader Program (SetSubroutines): OpenGL resets the subroutine uniforms each time glUseProgram is called, so the indices are stored for each program and stage, and they are applied again only when the program actually changes (or when they change)
+- the active texture unit, and the texture bound to each target of each unit (BindTexture)
+- the Vertex Array Object (BindVertexArray): the meshes drawn through the RenderState do not unbind their VAO after the draw call, so consecutive draw calls of the same mesh do not bind it again
+- the blending function (BlendFunc), the enabled capabilities (Enable, Disable), and the size of the points (PointSize)
+
+The headless simulation runs the render passes of the game (work/project/render_passes.h) on a recording stub of the OpenGL functions (headless.cpp, --bench-render-state), and checks that the state of each draw call is the same with and without the cache.
+
+N.B.) the OpenGL state changed outside the RenderState (e.g., by the ImGui renderer, or by the creation of textures and VAOs) is unknown to the cache: after these calls, Invalidate must be called, so the next calls are always issued
+N.B.) the class uses only OpenGL functions (glad must be included before this file)
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// kinds of state tracked by the RenderState (for the counters of the calls)
+enum RenderStateCalls { PROGRAM_CALLS, SUBROUTINE_CALLS, ACTIVE_TEXTURE_CALLS, TEXTURE_CALLS, VERTEX_ARRAY_CALLS, BLEND_CALLS, CAPABILITY_CALLS, POINT_SIZE_CALLS, NUM_RENDER_STATE_CALLS };
+
+/////////////////// RENDERSTATE class ///////////////////////
+class RenderState
+{
+public:
+    // calls sent to the driver, and calls skipped, for each kind of state, since the last reset
+    unsigned long issued[NUM_RENDER_STATE_CALLS];
+    unsigned long elided[NUM_RENDER_STATE_CALLS];
+
+    RenderState()
+    {
+        this->Invalidate();
+        this->ResetCounters();
+    }
+
+    //////////////////////////////////////////
+    // We forget the current state: the next call of each kind is always issued
+    void Invalidate()
+    {
+        this->program = unknown;
+        this->activeUnit = unknown;
+        this->textures.clear();
+        this->vertexArray = unknown;
+        this->blendSource = this->blendDestination = unknown;
+        this->capabilities.clear();
+        this->pointSize = -1.0f;
+    }
+
+    // We reset the counters of the calls
+    void ResetCounters()
+    {
+        for (int c = 0; c < NUM_RENDER_STATE_CALLS; c++)
+            this->issued[c] = this->elided[c] = 0;
+    }
+
+    // We return the total number of calls issued and elided
+    unsigned long TotalIssued() const { return Sum(this->issued); }
+    unsigned long TotalElided() const { return Sum(this->elided); }
+
+    //////////////////////////////////////////
+    // We use a Shader Program: if it changes, the subroutine uniforms set for it are applied again
+    void UseProgram(GLuint program)
+    {
+        if (program == this->program)
+        {
+            this->elided[PROGRAM_CALLS]++;
+            return;
+        }
+        glUseProgram(program);
+        this->issued[PROGRAM_CALLS]++;
+        this->program = program;
+
+        // glUseProgram resets the subroutine uniforms of all the stages
+        for (SubroutineMap::iterator s = this->subroutines.begin(); s != this->subroutines.end(); ++s)
+            if (s->first.first == program)
+                this->ApplySubroutines(s->first.second, s->second);
+    }
+
+    //////////////////////////////////////////
+    // We set the indices of the subroutine uniforms of a stage (e.g., GL_FRAGMENT_SHADER) of a Shader Program (count must be the number of active subroutine uniform locations of the stage)
+    // they are applied now if the program is in use and they change, otherwise when the program is used
+    void SetSubroutines(GLuint program, GLenum stage, GLsizei count, const GLuint* indices)
+    {
+        std::vector<GLuint> &current = this->subroutines[std::make_pair(program, stage)];
+        bool changed = (current.size() != (size_t)count) || !std::equal(current.begin(), current.end(), indices);
+        if (changed)
+            current.assign(indices, indices + count);
+        if (program != this->program)
+            return;
+        if (changed)
+            this->ApplySubroutines(stage, current);
+        else
+            this->elided[SUBROUTINE_CALLS]++;
+    }
+
+    //////////////////////////////////////////
+    // We bind a texture to a target (e.g., GL_TEXTURE_2D) of a texture unit (0, 1, ...): the active unit is changed only if the texture is not already bound
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        TextureMap::iterator bound = this->textures.find(std::make_pair(unit, target));
+        if (bound != this->textures.end() && bound->second == texture)
+        {
+            this->elided[TEXTURE_CALLS]++;
+            return;
+        }
+        this->ActiveTexture(unit);
+        glBindTexture(target, texture);
+        this->issued[TEXTURE_CALLS]++;
+        this->textures[std::make_pair(unit, target)] = texture;
+    }
+
+    //////////////////////////////////////////
+    // We change the active texture unit (0, 1, ...), e.g. before changing the parameters of a texture bound to it
+    void ActiveTexture(GLuint unit)
+    {
+        if (unit == this->activeUnit)
+        {
+            this->elided[ACTIVE_TEXTURE_CALLS]++;
+            return;
+        }
+        glActiveTexture(GL_TEXTURE0 + unit);
+        this->issued[ACTIVE_TEXTURE_CALLS]++;
+        this->activeUnit = unit;
+    }
+
+    //////////////////////////////////////////
+    // We bind a Vertex Array Object
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (vertexArray == this->vertexArray)
+        {
+            this->elided[VERTEX_ARRAY_CALLS]++;
+            return;
+        }
+        glBindVertexArray(vertexArray);
+        this->issued[VERTEX_ARRAY_CALLS]++;
+        this->vertexArray = vertexArray;
+    }
+
+    //////////////////////////////////////////
+    // We set the blending function
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        if (source == this->blendSource && destination == this->blendDestination)
+        {
+            this->elided[BLEND_CALLS]++;
+            return;
+        }
+        glBlendFunc(source, destination);
+        this->issued[BLEND_CALLS]++;
+        this->blendSource = source;
+        this->blendDestination = destination;
+    }
+
+    //////////////////////////////////////////
+    // We enable or disable a capability (e.g., GL_BLEND)
+    void Enable(GLenum capability) { this->SetCapability(capability, true); }
+    void Disable(GLenum capability) { this->SetCapability(capability, false); }
+
+    //////////////////////////////////////////
+    // We set the size (in pixels) of the points
+    void PointSize(GLfloat size)
+    {
+        if (size == this->pointSize)
+        {
+            this->elided[POINT_SIZE_CALLS]++;
+            return;
+        }
+        glPointSize(size);
+        this->issued[POINT_SIZE_CALLS]++;
+        this->pointSize = size;
+    }
+
+private:
+    typedef std::map<std::pair<GLuint, GLenum>, std::vector<GLuint> > SubroutineMap;
+    typedef std::map<std::pair<GLuint, GLenum>, GLuint> TextureMap;
+
+    // value of the state not known by the cache
+    static const GLuint unknown = 0xFFFFFFFF;
+
+    GLuint program;
+    // indices of the subroutine uniforms of each program and stage
+    SubroutineMap subroutines;
+    // active unit, and texture bound to each unit and target
+    GLuint activeUnit;
+    TextureMap textures;
+    GLuint vertexArray;
+    GLenum blendSource, blendDestination;
+    // enabled and disabled capabilities (the ones missing are unknown)
+    std::map<GLenum, bool> capabilities;
+    // size of the points (negative if unknown)
+    GLfloat pointSize;
+
+    //////////////////////////////////////////
+    // We send the indices of the subroutine uniforms of a stage of the current program
+    void ApplySubroutines(GLenum stage, const std::vector<GLuint> &indices)
+    {
+        if (indices.empty())
+            return;
+        glUniformSubroutinesuiv(stage, (GLsizei)indices.size(), indices.data());
+        this->issued[SUBROUTINE_CALLS]++;
+    }
+
+    //////////////////////////////////////////
+    // We enable or disable a capability, if it is not already in that state
+    void SetCapability(GLenum capability, bool enabled)
+    {
+        std::map<GLenum, bool>::iterator current = this->capabilities.find(capability);
+        if (current != this->capabilities.end() && current->second == enabled)
+        {
+            this->elided[CAPABILITY_CALLS]++;
+            return;
+        }
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+        this->issued[CAPABILITY_CALLS]++;
+        this->capabilities[capability] = enabled;
+    }
+
+    static unsigned long Sum(const unsigned long* counters)
+    {
+        unsigned long total = 0;
+        for (int c = 0; c < NUM_RENDER_STATE_CALLS; c++)
+            total += counters[c];
+        return total;
+    }
+};
@@ -1,6 +1,11 @@
 /*
 Shader class
 - loading Shader source code, Shader Program creation
+- cache of the locations of the uniforms, and typed setters
+
+After the linking, the active uniforms of the Shader Program are introspected once (glGetProgramiv / glGetActiveUniform), and their locations are stored in a cache, by name: each element of an array is stored too (e.g., "lights[0]", "lights[1]", ...).
+The application gets the location of a uniform from the cache (Uniform) once, outside the rendering loop, and then it uses the typed setters (SetFloat, SetVec3, SetMat4, ...) with the location: in this way, the rendering loop does not build strings, and does not search names in the cache or in the driver.
+Each search in the cache is counted (lookups): the counter can be read and reset at each frame, to check that the rendering loop does not search any name.
 
 N.B. ) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader.h
 
@@ -20,17 +25,25 @@ using namespace std;
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <vector>
+
+// GLM library, for the typed setters
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 /////////////////// SHADER class ///////////////////////
 class Shader
 {
 public:
     GLuint Program;
+    // searches of names in the cache of the uniforms (with Uniform, or with the setters using the name), since the last reset
+    unsigned long lookups;
 
     //////////////////////////////////////////
 
     //constructor
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath) : lookups(0)
     {
         // Step 1: we retrieve shaders source code from provided filepaths
         string vertexCode;
@@ -94,6 +107,9 @@ public:
         // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+
+        // Step 5: we store the locations of the active uniforms
+        this->IntrospectUniforms();
     }
 
     //////////////////////////////////////////
@@ -104,7 +120,74 @@ public:
     // We delete the Shader Program when application closes
     void Delete() { glDeleteProgram(this->Program); }
 
+    //////////////////////////////////////////
+    // We return the location of a uniform (-1 if it is not an active uniform of the Shader Program), searching it in the cache
+    // (to be called outside the rendering loop: the location is then used with the typed setters)
+    GLint Uniform(const string &name)
+    {
+        this->lookups++;
+        map<string, GLint>::const_iterator it = this->locations.find(name);
+        return (it != this->locations.end()) ? it->second : -1;
+    }
+
+    // number of active uniforms (the elements of the arrays are counted separately)
+    size_t NumUniforms() const { return this->locations.size(); }
+
+    //////////////////////////////////////////
+    // typed setters, with the location of the uniform (no search)
+    void SetInt(GLint location, GLint value) { glUniform1i(location, value); }
+    void SetFloat(GLint location, GLfloat value) { glUniform1f(location, value); }
+    void SetVec3(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, glm::value_ptr(value)); }
+    void SetVec3(GLint location, const GLfloat* value) { glUniform3fv(location, 1, value); }
+    void SetVec4(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, glm::value_ptr(value)); }
+    void SetMat4(GLint location, const glm::mat4 &value) { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+
+    // typed setters with the name of the uniform (a search in the cache, counted in lookups), for the uniforms set only once
+    void SetInt(const string &name, GLint value) { this->SetInt(this->Uniform(name), value); }
+    void SetFloat(const string &name, GLfloat value) { this->SetFloat(this->Uniform(name), value); }
+    void SetVec3(const string &name, const glm::vec3 &value) { this->SetVec3(this->Uniform(name), value); }
+    void SetVec4(const string &name, const glm::vec4 &value) { this->SetVec4(this->Uniform(name), value); }
+    void SetMat4(const string &name, const glm::mat4 &value) { this->SetMat4(this->Uniform(name), value); }
+
 private:
+    // locations of the active uniforms, by name
+    map<string, GLint> locations;
+
+    //////////////////////////////////////////
+    // We query the active uniforms of the Shader Program (only once, after the linking), and we store their locations
+    void IntrospectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        vector<GLchar> buffer(maxLength + 1);
+        for (GLint u = 0; u < count; u++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(this->Program, (GLuint)u, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            string name(buffer.data(), length);
+            // the uniforms in uniform blocks have no location
+            GLint location = glGetUniformLocation(this->Program, name.c_str());
+            if (location < 0)
+                continue;
+            // the name of an array ends with "[0]": we store the array name, and each element
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                string base = name.substr(0, name.size() - 3);
+                this->locations[base] = location;
+                for (GLint e = 0; e < size; e++)
+                {
+                    string element = base + "[" + to_string(e) + "]";
+                    this->locations[element] = glGetUniformLocation(this->Program, element.c_str());
+                }
+            }
+            else
+                this->locations[name] = location;
+        }
+    }
+
     //////////////////////////////////////////
 
     // Check compilation and linking errors
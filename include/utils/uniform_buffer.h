@@ -0,0 +1,69 @@
+/*
+UniformBuffer class
+- a Uniform Buffer Object (UBO), with the data of a uniform block shared by several Shader Programs
+
+The buffer is bound to a binding point of the context (glBindBufferBase), and each Shader Program using the block connects its block to the same binding point (glUniformBlockBinding, see BindBlock): the data are uploaded once (e.g., once per frame for the camera and the lights), and all the programs read them, without setting the uniforms of each program.
+The layout of the block must be std140, so the structure on the CPU side can be written with explicit offsets, independently of the driver:
+- a float or int takes 4 bytes, a vec2 8 bytes, a vec3 and a vec4 16 bytes (a float after a vec3 fills its 4 free bytes)
+- each element of an array, and each column of a matrix, is aligned to 16 bytes (e.g., vec3 lights[3] takes 48 bytes, as vec4 lights[3])
+- the size of the block is a multiple of 16 bytes
+
+Several buffers can use the same binding point, to change the data read by the programs with a single call (Bind), e.g. a buffer for each material.
+
+N.B.) the GLSL blocks are declared as:
+layout (std140) uniform BlockName
+{
+    ...
+};
+*/
+
+#pragma once
+
+/////////////////// UNIFORMBUFFER class ///////////////////////
+class UniformBuffer
+{
+public:
+    GLuint UBO;
+    // binding point of the buffer
+    GLuint binding;
+    // size of the block, in bytes
+    GLsizeiptr size;
+
+    //////////////////////////////////////////
+    // constructor: we create the buffer (size bytes), and we bind it to its binding point
+    UniformBuffer(GLsizeiptr size, GLuint binding) : binding(binding), size(size)
+    {
+        glGenBuffers(1, &this->UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        this->Bind();
+    }
+
+    //////////////////////////////////////////
+    // We connect the uniform block of a Shader Program to the binding point of the buffer (only once, after the linking)
+    // the function returns false if the program has no active block with the name
+    bool BindBlock(GLuint program, const GLchar* blockName)
+    {
+        GLuint index = glGetUniformBlockIndex(program, blockName);
+        if (index == GL_INVALID_INDEX)
+            return false;
+        glUniformBlockBinding(program, index, this->binding);
+        return true;
+    }
+
+    //////////////////////////////////////////
+    // We upload the data of the block (size bytes)
+    void Update(const void* data)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, this->size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // We bind the buffer to its binding point (when several buffers share the same binding point)
+    void Bind() { glBindBufferBase(GL_UNIFORM_BUFFER, this->binding, this->UBO); }
+
+    // We delete the buffer when application closes
+    void Delete() { glDeleteBuffers(1, &this->UBO); }
+};
@@ -2,14 +2,15 @@
 13_illumination_models_ML_TX.vert: as 11_illumination_models_ML.vert, but with texturing
 
 N.B. 1) In this example, we consider point lights only. For different kind of lights, the computation must be changed (for example, a directional light is defined by the direction of incident light, so the lightDir is passed as uniform and not calculated in the shader like in this case with a point light).
+The number of lights is not fixed: the lights are read in the fragment shader from a buffer, only the ones touching the screen tile of the fragment (see utils/light_tiles.h), and the light incidence directions are calculated there from the view position of the fragment (so they do not use interpolators).
 
-N.B. 2)
-There are other methods (more efficient) to pass multiple data to the shaders, using for example Uniform Buffer Objects.
-With last versions of OpenGL, using structures like the one cited above, it is possible to pass a "dynamic" number of lights
+N.B. 2) the data shared by all the shaders of the scene are passed using Uniform Buffer Objects (see utils/uniform_buffer.h), uploaded once per frame: the Camera block (view and projection matrices, used also by instance.vert and particle.vert) and the Lights block of the fragment shader (the tiling of the lights). The layout of the blocks is std140.
 https://www.geeks3d.com/20140704/gpu-buffers-introduction-to-opengl-3-1-uniform-buffers-objects/
 https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL (scroll down a bit)
 https://hub.packtpub.com/opengl-40-using-uniform-blocks-and-uniform-buffer-objects/
 
+N.B. 3) the shader is used with instanced rendering: the model matrix is a per-instance attribute (locations 3-6, as in instance.vert, see utils/instance_buffer.h), and the normal matrix is calculated here from it
+
 author: Davide Gadia
 
 Real-Time Graphics Programming - a.a. 2021/2022
@@ -20,33 +21,23 @@ Universita' degli Studi di Milano
 
 #version 410 core
 
-// number of lights in the scene
-#define NR_LIGHTS 3
-
 // vertex position in world coordinates
 layout (location = 0) in vec3 position;
 // vertex normal in world coordinate
 layout (location = 1) in vec3 normal;
 // UV coordinates
 layout (location = 2) in vec2 UV;
+// model matrix of the instance (a mat4 uses the locations from 3 to 6)
+layout (location = 3) in mat4 instanceMatrix;
 // the numbers used for the location in the layout qualifier are the positions of the vertex attribute
 // as defined in the Mesh class
 
-// vectors of lights positions (passed from the application)
-uniform vec3 lights[NR_LIGHTS];
-
-// model matrix
-uniform mat4 modelMatrix;
-// view matrix
-uniform mat4 viewMatrix;
-// Projection matrix
-uniform mat4 projectionMatrix;
-
-// normals transformation matrix (= transpose of the inverse of the model-view matrix)
-uniform mat3 normalMatrix;
-
-// array of light incidence directions (in view coordinate)
-out vec3 lightDirs[NR_LIGHTS];
+// view and projection matrices (shared by all the shaders, updated once per frame)
+layout (std140) uniform Camera
+{
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+};
 
 // the transformed normal (in view coordinate) is set as an output variable, to be "passed" to the fragment shader
 // this means that the normal values in each vertex will be interpolated on each fragment created during rasterization between two vertices
@@ -64,21 +55,19 @@ void main(){
 
   // vertex position in ModelView coordinate (see the last line for the application of projection)
   // when I need to use coordinates in camera coordinates, I need to split the application of model and view transformations from the projection transformations
-  vec4 mvPosition = viewMatrix * modelMatrix * vec4( position, 1.0 );
+  mat4 modelViewMatrix = viewMatrix * instanceMatrix;
+  vec4 mvPosition = modelViewMatrix * vec4( position, 1.0 );
+
+  // normals transformation matrix (= transpose of the inverse of the model-view matrix)
+  // it is different for each instance, so it is calculated here instead of being passed as uniform
+  mat3 normalMatrix = transpose(inverse(mat3(modelViewMatrix)));
 
-  // view direction, negated to have vector from the vertex to the camera
+  // view direction, negated to have vector from the vertex to the camera (the fragment shader uses it also to calculate the light incidence directions)
   vViewPosition = -mvPosition.xyz;
 
   // transformations are applied to the normal
   vNormal = normalize( normalMatrix * normal );
 
-  // light incidence directions for all the lights (in view coordinate)
-  for (int i=0;i<NR_LIGHTS;i++)
-  {
-    vec4 lightPos = viewMatrix  * vec4(lights[i], 1.0);;
-    lightDirs[i] = lightPos.xyz - mvPosition.xyz;
-  }
-
   // I assign the values to a variable with "out" qualifier so to use the per-fragment interpolated values in the Fragment shader
   interp_UV = UV;
 
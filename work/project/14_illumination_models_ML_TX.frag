@@ -10,7 +10,7 @@ N.B. 3)  the different illumination models are implemented using Shaders Subrout
 
 N.B. 4)  only Blinn-Phong and GGX illumination models are considered in this shader
 
-N.B. 5) see note 2 in the vertex shader for considerations on multiple lights management
+N.B. 5) see notes 1 and 2 in the vertex shader for considerations on multiple lights management: each fragment evaluates only the lights of its screen tile (see utils/light_tiles.h), and the contribution of each light is attenuated to 0 at its radius
 
 author: Davide Gadia
 
@@ -22,17 +22,11 @@ Universita' degli Studi di Milano
 
 #version 410 core
 
-// number of lights in the scene
-#define NR_LIGHTS 3
-
 const float PI = 3.14159265359;
 
 // output shader variable
 out vec4 colorFrag;
 
-// array with lights incidence directions (calculated in vertex shader, interpolated by rasterization)
-in vec3 lightDirs[NR_LIGHTS];
-
 // the transformed normal has been calculated per-vertex in the vertex shader
 in vec3 vNormal;
 // vector from fragment to camera (in view coordinate)
@@ -41,27 +35,72 @@ in vec3 vViewPosition;
 // interpolated texture coordinates
 in vec2 interp_UV;
 
-// texture repetitions
-uniform float repeat;
-
 // texture sampler
 uniform sampler2D tex;
 
-// ambient and specular components (passed from the application)
-uniform vec3 ambientColor;
-uniform vec3 specularColor;
-// weight of the components
-// in this case, we can pass separate values from the main application even if Ka+Kd+Ks>1. In more "realistic" situations, I have to set this sum = 1, or at least Kd+Ks = 1, by passing Kd as uniform, and then setting Ks = 1.0-Kd
-uniform float Ka;
-uniform float Kd;
-uniform float Ks;
+// material (passed from the application, using a Uniform Buffer Object for each material, see note 2 in the vertex shader)
+// the order of the members follows the std140 layout: each vec3 is followed by a float, which fills its last 4 bytes
+layout (std140) uniform Material
+{
+    // ambient and specular components
+    vec3 ambientColor;
+    // weight of the ambient component
+    float Ka;
+    vec3 specularColor;
+    // weights of the diffusive and specular components
+    // in this case, we can pass separate values from the main application even if Ka+Kd+Ks>1. In more "realistic" situations, I have to set this sum = 1, or at least Kd+Ks = 1, by passing Kd as uniform, and then setting Ks = 1.0-Kd
+    float Kd;
+    float Ks;
+    // shininess coefficient
+    float shininess;
+    // uniforms for GGX model
+    float alpha; // rugosity - 0 : smooth, 1: rough
+    float F0; // fresnel reflectance at normal incidence
+    // texture repetitions
+    float repeat;
+};
+
+// tiling of the lights (updated once per frame)
+layout (std140) uniform Lights
+{
+    // size of the tiles (in pixels), number of tiles on the x-axis and on the y-axis, number of lights
+    ivec4 tiling;
+};
+// lights, in view coordinates: 2 texels for each light (position and radius, color and intensity)
+uniform samplerBuffer lightData;
+// offset and number of the lights of each tile in lightIndices (tiles ordered by rows, from the bottom of the screen)
+uniform usamplerBuffer tileLights;
+// indices of the lights of all the tiles
+uniform usamplerBuffer lightIndices;
 
-// shininess coefficients (passed from the application)
-uniform float shininess;
+////////////////////////////////////////////////////////////////////
 
-// uniforms for GGX model
-uniform float alpha; // rugosity - 0 : smooth, 1: rough
-uniform float F0; // fresnel reflectance at normal incidence
+//////////////////////////////////////////
+// we find the lights of the tile of the fragment: offset and number of its lights in lightIndices
+uvec2 TileLights()
+{
+    ivec2 tile = min(ivec2(gl_FragCoord.xy) / tiling.x, tiling.yz - 1);
+    return texelFetch(tileLights, tile.y * tiling.y + tile.x).xy;
+}
+
+//////////////////////////////////////////
+// we read the k-th light of the tile, and we return its radiance at the fragment, and the normalized light incidence direction (L)
+vec3 LightRadiance(uvec2 lights, uint k, out vec3 L)
+{
+    int light = int(texelFetch(lightIndices, int(lights.x + k)).r);
+    vec4 positionRadius = texelFetch(lightData, 2 * light);
+    vec4 colorIntensity = texelFetch(lightData, 2 * light + 1);
+
+    // vViewPosition is the vector from the fragment to the camera, so the fragment position (in view coordinates) is -vViewPosition
+    vec3 lightDir = positionRadius.xyz + vViewPosition;
+    float distance = max(length(lightDir), 0.0001);
+    L = lightDir / distance;
+
+    // the contribution falls smoothly to 0 at the radius of the light
+    float ratio = distance / positionRadius.w;
+    float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+    return colorIntensity.rgb * colorIntensity.a * window * window;
+}
 
 ////////////////////////////////////////////////////////////////////
 
@@ -88,11 +127,13 @@ vec4 BlinnPhong_ML_TX() // this name is the one which is detected by the SetupSh
     // normalization of the per-fragment normal
     vec3 N = normalize(vNormal);
 
-    //for all the lights in the scene
-    for(int i = 0; i < NR_LIGHTS; i++)
+    //for all the lights of the tile of the fragment
+    uvec2 lights = TileLights();
+    for(uint k = 0u; k < lights.y; k++)
     {
-        // normalization of the per-fragment light incidence direction
-        vec3 L = normalize(lightDirs[i]);
+        // radiance of the light, and per-fragment light incidence direction
+        vec3 L;
+        vec3 radiance = LightRadiance(lights, k, L);
 
         // Lambert coefficient
         float lambertian = max(dot(L,N), 0.0);
@@ -111,9 +152,9 @@ vec4 BlinnPhong_ML_TX() // this name is the one which is detected by the SetupSh
             // shininess application to the specular component
             float specular = pow(specAngle, shininess);
 
-            // We add diffusive (= color sampled from texture) and specular components to the final color
+            // We add diffusive (= color sampled from texture) and specular components to the final color, multiplied by the radiance of the light
             // N.B. ): in this implementation, the sum of the components can be different than 1
-            color += Kd * lambertian * surfaceColor + vec4(Ks * specular * specularColor,1.0);
+            color.rgb += radiance * (Kd * lambertian * surfaceColor.rgb + Ks * specular * specularColor);
         }
     }
     return color;
@@ -154,11 +195,13 @@ vec4 GGX_ML_TX() // this name is the one which is detected by the SetupShaders()
     // we initialize the final color
     vec3 color = vec3(0.0);
 
-    //for all the lights in the scene
-    for(int i = 0; i < NR_LIGHTS; i++)
+    //for all the lights of the tile of the fragment
+    uvec2 lights = TileLights();
+    for(uint k = 0u; k < lights.y; k++)
     {
-        // normalization of the per-fragment light incidence direction
-        vec3 L = normalize(lightDirs[i]);
+        // radiance of the light, and per-fragment light incidence direction
+        vec3 L;
+        vec3 radiance = LightRadiance(lights, k, L);
 
         // cosine angle between direction of light and normal
         float NdotL = max(dot(N, L), 0.0);
@@ -204,8 +247,8 @@ vec4 GGX_ML_TX() // this name is the one which is detected by the SetupShaders()
             // the rendering equation is:
             //integral of: BRDF * Li * (cosine angle between N and L)
             // BRDF in our case is: the sum of Lambert and GGX
-            // Li is considered as equal to 1: light is white, and we have not applied attenuation. With colored lights, and with attenuation, the code must be modified and the Li factor must be multiplied to finalColor
-            color += (lambert + specular)*NdotL;
+            // Li is the radiance of the light: its color and intensity, attenuated with the distance
+            color += (lambert + specular)*NdotL*radiance;
         }
     }
     return vec4(color,1.0);
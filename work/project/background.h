@@ -0,0 +1,77 @@
+/*
+Background:
+- transformations of the instanced objects in the background of the scene (the cross, X)
+- bounds of their positions and spin speeds, for their quantization (see utils/instance_transform.h)
+
+The function is shared by the game (project.cpp) and by the headless simulation (headless.cpp).
+Each object depends only on its index and on the seed (the random numbers are taken from a CounterRandom, with the index as stream, see utils/random.h), so the objects can be generated in any order, on any number of threads, with the same result.
+The first backgroundLayerSize objects create the cross; each following group of backgroundLayerSize objects creates the same cross, displaced farther on the z-axis, so the number of objects can grow to millions without changing the first ones.
+
+N.B.) the GLM headers must be included before this file
+*/
+
+#pragma once
+
+#include <utils/instance_transform.h>
+#include <utils/random.h>
+
+// number of objects of a layer (a complete cross)
+const int backgroundLayerSize = 10000;
+// distance on the z-axis between two consecutive layers
+const float backgroundLayerDistance = 15.0f;
+// maximum scale of an object
+const float backgroundMaxScale = 0.5f;
+// range of the angular speed (radians per second) of the spin of each object
+const float backgroundMinSpinSpeed = 0.2f;
+const float backgroundMaxSpinSpeed = 2.0f;
+
+//////////////////////////////////////////
+// We create the transformation (translate * scale * rotate) of the i-th object of the background, for a seed
+inline InstanceTransform BackgroundInstance(int index, unsigned int seed)
+{
+    CounterRandom random(seed, (uint32_t)index);
+    float offset = 6.0f;                                // random constant for their lineup
+    int i = index % backgroundLayerSize;
+    int layer = index / backgroundLayerSize;
+
+    // displacement value creates randomness for each instanced object
+    float displacement = random.Range((int)(2 * offset * 100)) / 100.0f - offset;
+    // to create the letter X, each object goes left if even or right if odd
+    // they meet at the middle and moves apart towards the end
+    float x = (i % 2 == 0) ? -90.0f + (0.0165f * i) + displacement + 5.0f : 90.0f - (0.0165f * i) - displacement - 5.0f;
+    displacement = random.Range((int)(2 * offset * 100)) / 100.0f - offset;
+    // on a bigger picture, it is setting the height of all objects on y-axis
+    float y = -33.0f + (0.0165f * i) + displacement;
+    // whole shape's thickness, and distance of the layer
+    float z = displacement * 2.0f - layer * backgroundLayerDistance;
+
+    //scaling each object between 0.1f-0.5f
+    float scale = random.Range(40) / 100.0f + 0.1f;
+    // rotation to create randomness on each object
+    float rotAngle = static_cast<float>(random.Range(360));
+
+    InstanceTransform transform;
+    transform.position = glm::vec3(x, y, z);
+    transform.scale = scale;
+    // quaternion of the rotation of rotAngle radians around the axis
+    glm::vec3 axis = glm::normalize(glm::vec3(0.4f, 0.6f, 0.8f));
+    transform.rotation = glm::vec4(axis * glm::sin(rotAngle * 0.5f), glm::cos(rotAngle * 0.5f));
+
+    // each object spins around a random axis (uniform on the sphere), with random speed and phase
+    float cosTheta = 2.0f * random.Uniform() - 1.0f;
+    float sinTheta = glm::sqrt(1.0f - cosTheta * cosTheta);
+    float phi = 6.28318530718f * random.Uniform();
+    glm::vec3 spinAxis = glm::vec3(sinTheta * glm::cos(phi), sinTheta * glm::sin(phi), cosTheta);
+    float spinSpeed = backgroundMinSpinSpeed + (backgroundMaxSpinSpeed - backgroundMinSpinSpeed) * random.Uniform();
+    transform.spin = glm::vec4(spinAxis * spinSpeed, 6.28318530718f * random.Uniform());
+    return transform;
+}
+
+//////////////////////////////////////////
+// We create the quantizer of the positions of the first n objects of the background (all the layers containing them)
+inline InstanceQuantizer BackgroundQuantizer(int n)
+{
+    int layers = glm::max((n + backgroundLayerSize - 1) / backgroundLayerSize, 1);
+    // the cross spans [-91, 91] on the x-axis, [-39, 138] on the y-axis, and [-12, 12] on the z-axis (plus the displacement of the layers)
+    return InstanceQuantizer(glm::vec3(-91.0f, -39.0f, -12.0f - (layers - 1) * backgroundLayerDistance), glm::vec3(91.0f, 138.0f, 12.0f), backgroundMaxScale, backgroundMaxSpinSpeed);
+}
@@ -0,0 +1,113 @@
+/*
+Bowling scene:
+- creation of the rigid bodies of the bowling scene (lanes, pins and balls)
+
+The functions are shared by the game (project.cpp) and by the headless simulation (headless.cpp), so that both build exactly the same physical world through Physics::createRigidBody.
+Each created rigid body is added to the EntityRegistry with its kind (see entities.h).
+
+N.B.) utils/physics.h and the GLM headers must be included before this file
+*/
+
+#pragma once
+
+#include "entities.h"
+
+// number of lanes (static planes) of the scene
+const int planeNum = 3;
+// distance on the x-axis between two consecutive lanes
+const float laneOffset = 5.0f;
+
+// plane has to have a little height to be a collidable
+const glm::vec3 plane_pos = glm::vec3(0.0f, -1.0f, 4.0f);
+const glm::vec3 plane_size = glm::vec3(2.0f, 0.1f, 11.0f);
+const glm::vec3 plane_rot = glm::vec3(0.0f, 0.0f, 0.0f);
+
+// First 10 bowling pins of each lane are in a triangle shape
+const int num_rows = 4;
+// total number of the pins per plane
+const int total_pins = num_rows * (num_rows + 1) / 2;
+// dimension of the pin
+const glm::vec3 pin_size = glm::vec3(0.12f, 0.38f, 0.12f);
+
+// dimension of the bullets
+const glm::vec3 ball_size = glm::vec3(0.16f, 0.16f, 0.16f);
+// initial Speed of the bullet
+const float shootInitialSpeed = 40.0f;
+
+// the bodies fallen from the lanes below this height are removed from the simulation
+const float fallLimit = -7.0f;
+
+// particles emitted per second by each pin and each ball, when they move faster than emissionMinSpeed (m/s)
+const float pinEmissionRate = 60.0f;
+const float ballEmissionRate = 120.0f;
+const float emissionMinSpeed = 0.5f;
+
+//////////////////////////////////////////
+// pins and balls emit particles while they move, lanes do not emit
+inline void SetupEmitters(EntityRegistry &registry)
+{
+    registry.SetEmitter(PIN_ENTITY, pinEmissionRate, emissionMinSpeed);
+    registry.SetEmitter(BALL_ENTITY, ballEmissionRate, emissionMinSpeed);
+}
+
+//////////////////////////////////////////
+// creating three planes with mass=0 to not being a movable object
+inline void CreateLanes(Physics &physics, EntityRegistry &registry)
+{
+    for (int h = 0; h < planeNum; h++)
+        registry.Add(PLANE_ENTITY, physics.createRigidBody(BOX, plane_pos + glm::vec3(h * laneOffset, 0.0f, 0.0f), plane_size, plane_rot, 0.0f, 0.2f, 0.2f));
+}
+
+//////////////////////////////////////////
+// creating triangle shape for the first 10 pins of each lane (their (x, z) coordinates):
+//     (-0.75f, -3.0f)    (-0.25f, -3.0f)   (0.25f, -3.0f)    (0.75f, -3.0f)
+//              (-0.5f, -2.5f)   (0.0f, -2.5f)    (0.5f, -2.5f)
+//                      (-0.25f, -2.0f)   (0.25f, -2.0f)
+//                              (0.0f, -1.5f)
+// bowling pins are created with masses baseMass, baseMass+massStep, baseMass+2*massStep on the three lanes, respectively
+inline void CreatePins(Physics &physics, EntityRegistry &registry, float baseMass = 1.5f, float massStep = 1.0f, float friction = 0.5f, float restitution = 0.5f)
+{
+    // placeholder rotation
+    glm::vec3 pin_rot = glm::vec3(0.0f, 0.0f, 0.0f);
+
+    for (int h = 0; h < planeNum; h++)
+    {
+        for (int i = 0; i < num_rows; i++)
+        {
+            for (int j = 0; j < (num_rows - i); j++) // to make it decrease row by row, it has to be equal to i
+            {
+                glm::vec3 pin_pos = glm::vec3((h * laneOffset + ((-0.75f + 0.25f * i) + 0.5f * j)), 0.0f, (i * 0.5f - 3.0f));
+                registry.Add(PIN_ENTITY, physics.createRigidBody(BOX, pin_pos, pin_size, pin_rot, baseMass + massStep * float(h), friction, restitution));
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////
+// we retire the bodies fallen from the lanes: they are removed from the registry, and then from the simulation
+inline void RetireFallenBodies(Physics &physics, EntityRegistry &registry)
+{
+    if (physics.CollectOutOfBounds(fallLimit) == 0)
+        return;
+    for (int i = 0; i < physics.retiredBodies.size(); i++)
+        registry.Remove(physics.retiredBodies[i]);
+    physics.FlushRetired();
+}
+
+//////////////////////////////////////////
+// we "shoot" a bowling ball from the (x, z) position on the ground, applying the impulse passed as parameter
+inline btRigidBody* LaunchBall(Physics &physics, EntityRegistry &registry, float x, float z, glm::vec3 impulse)
+{
+    // we need a initial rotation, even if useless for a ball
+    glm::vec3 rot = glm::vec3(10.0f, 0.0f, 3.0f);
+
+    // Bowling ball is created with a realistic mass which is 2.85 kg (average mass IRL)
+    // y-axis value is -0.6 to create the effect of sending the ball close to ground as in real-life
+    btRigidBody* ball = physics.createRigidBody(SPHERE, glm::vec3(x, -0.6f, z), ball_size, rot, 2.85f, 0.2f, 0.2f);
+    registry.Add(BALL_ENTITY, ball);
+
+    // we apply the impulse and shoot the bullet in the scene
+    ball->applyCentralImpulse(btVector3(impulse.x, impulse.y, impulse.z));
+
+    return ball;
+}
@@ -0,0 +1,100 @@
+/*
+EntityRegistry class:
+- registry of the objects of the scene (lanes, pins and balls), each one associated to its rigid body, to the data for its rendering (model, size and texture), and to its particle emitter
+
+The entities are stored in a dense vector for each kind, so that the rendering loop can iterate over contiguous arrays of the same kind (same model and texture), instead of walking all the collision objects of the dynamics world and deducing their kind from the index.
+Each rigid body stores its kind in the user index, and its position in the vector of the kind in the user index 2: in this way, an entity can be removed in constant time (the last entity of the vector takes its place).
+
+N.B.) the GLM and Bullet headers must be included before this file
+*/
+
+#pragma once
+
+#include <vector>
+
+// emitters of particles of the entities
+#include <utils/particles.h>
+
+// the rendering model is only referenced by the registry
+class Model;
+
+// kinds of the entities of the scene
+enum EntityKind { PLANE_ENTITY, PIN_ENTITY, BALL_ENTITY, NUM_ENTITY_KINDS };
+
+// an object of the scene: its rigid body, and the data for its rendering
+struct Entity {
+    btRigidBody*  body;
+    Model*        model;        // model used for the rendering (NULL in the headless simulation)
+    glm::vec3     size;         // scale applied to the model
+    unsigned int  texture;      // OpenGL texture of the model
+    ParticleEmitter emitter;    // particles emitted by the object when it moves
+};
+
+/////////////////// EntityRegistry class ///////////////////////
+class EntityRegistry
+{
+public:
+    // dense vectors of entities, one for each kind
+    std::vector<Entity> kinds[NUM_ENTITY_KINDS];
+
+    // rendering data and emitter used by default for each kind (all the pins, and all the balls, share the same model, size, texture and emitter)
+    Entity defaults[NUM_ENTITY_KINDS];
+
+    EntityRegistry()
+    {
+        for (int k = 0; k < NUM_ENTITY_KINDS; k++)
+            this->SetKind((EntityKind)k, NULL, glm::vec3(1.0f), 0);
+    }
+
+    //////////////////////////////////////////
+    // We set the rendering data used for the new entities of a kind
+    void SetKind(EntityKind kind, Model* model, glm::vec3 size, unsigned int texture)
+    {
+        this->defaults[kind].body = NULL;
+        this->defaults[kind].model = model;
+        this->defaults[kind].size = size;
+        this->defaults[kind].texture = texture;
+    }
+
+    //////////////////////////////////////////
+    // We set the particle emitter of the new entities of a kind
+    void SetEmitter(EntityKind kind, float rate, float minSpeed)
+    {
+        this->defaults[kind].emitter = ParticleEmitter(rate, minSpeed);
+    }
+
+    //////////////////////////////////////////
+    // We add a rigid body to the registry, with the default rendering data of its kind
+    void Add(EntityKind kind, btRigidBody* body)
+    {
+        Entity entity = this->defaults[kind];
+        entity.body = body;
+
+        // the rigid body keeps its kind and its position in the vector of the kind
+        body->setUserIndex(kind);
+        body->setUserIndex2((int)this->kinds[kind].size());
+        this->kinds[kind].push_back(entity);
+    }
+
+    //////////////////////////////////////////
+    // We remove the entity of a rigid body from the registry (before the rigid body is released by the Physics class)
+    // the last entity of the vector of the kind takes its place, so the vector remains compact
+    void Remove(btRigidBody* body)
+    {
+        int kind = body->getUserIndex();
+        int index = body->getUserIndex2();
+        if (kind < 0 || kind >= NUM_ENTITY_KINDS)
+            return;
+
+        std::vector<Entity> &entities = this->kinds[kind];
+        entities[index] = entities.back();
+        entities[index].body->setUserIndex2(index);
+        entities.pop_back();
+
+        // the rigid body is no more in the registry
+        body->setUserIndex(-1);
+    }
+
+    // number of entities of a kind
+    int Count(EntityKind kind) const { return (int)this->kinds[kind].size(); }
+};
@@ -0,0 +1,1424 @@
+/*
+headless.cpp: physical simulation of the bowling scene without an OpenGL context
+
+The same world of the game (lanes, pins and balls, see bowling_scene.h) is built through Physics::createRigidBody, a script of ball launches is replayed,
+and the simulation is stepped as fast as possible, in order to measure the physics throughput independently of the rendering.
+
+usage: ./headless.out [--steps N] [--launches N] [--script file] [--pin-mass m] [--pin-mass-step m] [--pin-friction f] [--pin-restitution r] [--threads N] [--rapid-fire N] [--ball-limit N]
+       ./headless.out --bench-threads N [--pins N] [--steps N]
+       ./headless.out --bench-particles
+       ./headless.out --bench-particle-layout
+       ./headless.out --bench-particle-budget N [--particle-policy drop|steal|grow] [--steps N]
+       ./headless.out --bench-particle-resize [--steps N]
+       ./headless.out --bench-particle-threads N
+       ./headless.out --bench-emitters [--pins N] [--steps N]
+       ./headless.out --bench-culling N [--threads N]
+       ./headless.out --bench-instance-stream N [--threads N]
+       ./headless.out --bench-instance-generation [--threads N]
+       ./headless.out --bench-instance-encoding N
+       ./headless.out --bench-instance-spin N
+       ./headless.out --bench-light-tiles N [--threads N]
+       ./headless.out --bench-render-state N
+
+A script file contains one launch per line, in the form: time x z dirX dirY dirZ (lines starting with # are ignored)
+
+--rapid-fire N replaces the script with N launches per second for the whole simulation (stress test of the creation of the balls).
+--ball-limit N keeps at most N balls in the scene: when a new ball is launched, the oldest one is released (its storage returns to the pool of the Physics class).
+--threads N uses the multithread version of the Physics class with N worker threads.
+--bench-threads N measures the step time of a scene with thousands of pins (--pins, default 2000), with the sequential simulation and then with 1, 2, 4, ... up to N threads.
+--bench-particles measures the CPU time spent at each frame to update the particles and to prepare their vertex buffer (see utils/particles.h), with 500, 10k and 100k particles.
+--bench-particle-layout compares the update of the particles stored as an array of structures (the previous layout) and as a structure of arrays (utils/particles.h), with 10k, 100k and 1M particles.
+--bench-particle-budget N runs the particle system with a budget of N particles, requesting 1.5 N particles per second (so the budget saturates), and reports the update time and the particles dropped or stolen by the saturation policy (--particle-policy, default steal).
+--bench-particle-resize changes the budget of the particle system at runtime (from 500 up to 100k particles, and back, several times), and reports the reallocations of the store and the time of the changes.
+--bench-particle-threads N measures the update of 1M particles on the calling thread, and then with a JobSystem of 1, 2, 4, ... up to N threads, checking that the particles are exactly the same after the update.
+--bench-emitters simulates the pin field of --bench-threads, with the particle emitters of the pins and the balls (see bowling_scene.h), and reports every second the moving emitters, the particles requested and emitted, and the alive particles.
+--bench-culling N measures the frustum culling of N instances (see utils/culling.h): scalar test, SIMD test, and SIMD test on the threads of a JobSystem (--threads, default all the hardware threads), checking that the visible instances are the same.
+--bench-instance-stream N requests N background instances (see background.h) to an InstanceGenerator, and simulates the frames of the game while they are generated on the worker thread: at each frame the new batches are taken (up to the upload budget of utils/instance_manager.h) and culled. It reports the frames needed to stream all the instances, the worst CPU time of a frame, and checks that the instances are the same generated on a single thread.
+--bench-instance-generation measures the generation of 10k, 100k, 1M and 10M background instances at startup: serial loop with rand() (the previous generation), serial generation with the counter-based generator (see utils/random.h), and parallel generation on a JobSystem (--threads, default all the hardware threads), checking that the parallel generation gives the same instances.
+--bench-instance-encoding N compares the encodings of N background instances (see utils/instance_transform.h): full matrices (64 bytes, without animation), compact transformations (48 bytes) and quantized transformations (24 bytes). It reports the memory of the buffer, the data uploaded in a frame with the upload budget of utils/instance_manager.h, the CPU time of the encoding, and the maximum error of the rebuilt vertices of the cube.
+--bench-instance-spin N verifies the spin animation of N background instances, evaluated in the vertex shader: the reference implementation (InstanceTransform::Matrix, the same computation of instance.vert) is compared with the GLM matrices at several times, for the compact and the quantized encodings. It reports the cost of animating the instances on the CPU instead (computation and upload of N matrices at each frame).
+--bench-light-tiles N measures the assignment of N point lights to the 32x32 pixel tiles of a 1200x900 screen (see utils/light_tiles.h): scalar test of each light against each tile, SIMD test, and SIMD test on the threads of a JobSystem (--threads, default all the hardware threads), checking that the lights of each tile are the same. It reports the average and maximum lights of a tile (the lights evaluated by a fragment, instead of all the N lights) and the bytes uploaded at each frame.
+--bench-render-state N runs the render passes of N frames of the game (see render_passes.h, the same code of the game) on a recording stub of the OpenGL functions (no context is created), and compares them with the same passes sending the calls directly, as the rendering loop before the cache of utils/render_state.h. It reports the calls of each kind sent to the stub at each frame (issued and elided by the cache), with and without the invalidation of the cache after the overlay, and checks that the state and the parameters of each draw call are the same.
+*/
+
+// declarations of the OpenGL functions: the ones used by the render state are defined by a recording stub (see BenchmarkRenderState), the loader is not linked
+#include <glad/glad.h>
+
+// GLM libraries for math operations
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// class developed during lab lectures for physical simulation
+#include <utils/physics.h>
+#include <utils/particles.h>
+#include <utils/culling.h>
+#include <utils/instance_generator.h>
+#include <utils/instance_transform.h>
+#include <utils/light_tiles.h>
+#include <utils/render_state.h>
+
+// lanes, pins and balls of the scene (shared with the game)
+#include "bowling_scene.h"
+// instanced objects of the background (shared with the game)
+#include "background.h"
+// state changes and draw calls of a frame (shared with the game, run on the recording stub of --bench-render-state)
+#include "render_passes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// a scripted ball launch: after "time" seconds of simulation, a ball is shot from (x, z) along direction
+struct Launch {
+    float     time;
+    float     x, z;
+    glm::vec3 direction;
+};
+
+// default script: a ball on each lane every half second, shot from the foul line towards the pins
+vector<Launch> DefaultScript(int launches, float interval = 0.5f);
+// script loaded from disk
+vector<Launch> LoadScript(const char* path);
+// number of pins still standing at the end of the simulation
+int CountStandingPins(EntityRegistry &registry);
+// benchmark of the step time of the multithread simulation, from 1 to maxThreads threads
+void BenchmarkThreads(int maxThreads, int pins, int steps);
+// a large scene for the benchmark: a wide floor with a grid of pins, and a row of balls shot through them
+void CreatePinField(Physics &physics, EntityRegistry &registry, int pins);
+// benchmark of the CPU time needed to pack the particles in the vertex buffer
+void BenchmarkParticles();
+// benchmark of the update of the particles, array of structures vs structure of arrays
+void BenchmarkParticleLayout();
+// benchmark of the particle system with a saturated budget
+void BenchmarkParticleBudget(int budget, ParticleSaturation saturation, int frames);
+// benchmark of the changes of the budget of the particle system at runtime
+void BenchmarkParticleResize(int frames);
+// benchmark of the multithread update of the particles
+void BenchmarkParticleThreads(int maxThreads);
+// benchmark of the emitters of particles with thousands of bodies
+void BenchmarkEmitters(int pins, int steps);
+// benchmark of the frustum culling of instances
+void BenchmarkCulling(int instances, int threads);
+// benchmark of the generation and streaming of the background instances
+void BenchmarkInstanceStream(int instances, int threads);
+// benchmark of the generation of the background instances at startup, serial and parallel
+void BenchmarkInstanceGeneration(int threads);
+// benchmark of the memory and of the precision of the encodings of the instances
+void BenchmarkInstanceEncoding(int instances);
+// verification and cost of the spin animation of the instances
+void BenchmarkInstanceSpin(int instances);
+// benchmark of the assignment of the lights to the screen tiles
+void BenchmarkLightTiles(int lights, int threads);
+// benchmark of the calls elided by the cache of the OpenGL state, on a recording stub
+void BenchmarkRenderState(int frames);
+
+int main(int argc, char** argv)
+{
+    // parameters of the simulation (same fixed time step of the game)
+    int steps = 6000;
+    int launches = 30;
+    const char* scriptPath = nullptr;
+    int threads = 0, benchThreads = 0, benchPins = 2000;
+    int rapidFire = 0, ballLimit = 0;
+    bool benchParticles = false, benchParticleLayout = false, benchParticleResize = false, benchEmitters = false, benchInstanceGeneration = false;
+    int particleBudget = 0, benchParticleThreads = 0, benchCulling = 0, benchInstanceStream = 0, benchInstanceEncoding = 0, benchInstanceSpin = 0, benchLightTiles = 0, benchRenderState = 0;
+    ParticleSaturation particleSaturation = STEAL_OLDEST_PARTICLES;
+    float pinMass = 1.5f, pinMassStep = 1.0f, pinFriction = 0.5f, pinRestitution = 0.5f;
+    const btScalar timeStep = 1.0f / 60.0f;
+
+    for (int a = 1; a < argc; a++)
+    {
+        bool hasValue = (a + 1 < argc);
+        if (!strcmp(argv[a], "--steps") && hasValue)
+            steps = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--launches") && hasValue)
+            launches = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--script") && hasValue)
+            scriptPath = argv[++a];
+        else if (!strcmp(argv[a], "--pin-mass") && hasValue)
+            pinMass = (float)atof(argv[++a]);
+        else if (!strcmp(argv[a], "--pin-mass-step") && hasValue)
+            pinMassStep = (float)atof(argv[++a]);
+        else if (!strcmp(argv[a], "--pin-friction") && hasValue)
+            pinFriction = (float)atof(argv[++a]);
+        else if (!strcmp(argv[a], "--pin-restitution") && hasValue)
+            pinRestitution = (float)atof(argv[++a]);
+        else if (!strcmp(argv[a], "--threads") && hasValue)
+            threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-threads") && hasValue)
+            benchThreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--pins") && hasValue)
+            benchPins = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--rapid-fire") && hasValue)
+            rapidFire = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--ball-limit") && hasValue)
+            ballLimit = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-particles"))
+            benchParticles = true;
+        else if (!strcmp(argv[a], "--bench-particle-layout"))
+            benchParticleLayout = true;
+        else if (!strcmp(argv[a], "--bench-particle-resize"))
+            benchParticleResize = true;
+        else if (!strcmp(argv[a], "--bench-culling") && hasValue)
+            benchCulling = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-instance-stream") && hasValue)
+            benchInstanceStream = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-instance-generation"))
+            benchInstanceGeneration = true;
+        else if (!strcmp(argv[a], "--bench-instance-encoding") && hasValue)
+            benchInstanceEncoding = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-instance-spin") && hasValue)
+            benchInstanceSpin = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-light-tiles") && hasValue)
+            benchLightTiles = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-render-state") && hasValue)
+            benchRenderState = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-emitters"))
+            benchEmitters = true;
+        else if (!strcmp(argv[a], "--bench-particle-threads") && hasValue)
+            benchParticleThreads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--bench-particle-budget") && hasValue)
+            particleBudget = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--particle-policy") && hasValue)
+        {
+            a++;
+            if (!strcmp(argv[a], "drop"))
+                particleSaturation = DROP_NEW_PARTICLES;
+            else if (!strcmp(argv[a], "grow"))
+                particleSaturation = GROW_PARTICLES;
+            else
+                particleSaturation = STEAL_OLDEST_PARTICLES;
+        }
+        else
+        {
+            std::cout << "Unknown or incomplete option: " << argv[a] << std::endl;
+            return -1;
+        }
+    }
+
+    if (benchThreads > 0)
+    {
+        BenchmarkThreads(benchThreads, benchPins, steps);
+        return 0;
+    }
+    if (benchParticles)
+    {
+        BenchmarkParticles();
+        return 0;
+    }
+    if (benchParticleLayout)
+    {
+        BenchmarkParticleLayout();
+        return 0;
+    }
+    if (benchCulling > 0)
+    {
+        BenchmarkCulling(benchCulling, threads);
+        return 0;
+    }
+    if (benchInstanceStream > 0)
+    {
+        BenchmarkInstanceStream(benchInstanceStream, threads);
+        return 0;
+    }
+    if (benchInstanceGeneration)
+    {
+        BenchmarkInstanceGeneration(threads);
+        return 0;
+    }
+    if (benchInstanceEncoding > 0)
+    {
+        BenchmarkInstanceEncoding(benchInstanceEncoding);
+        return 0;
+    }
+    if (benchInstanceSpin > 0)
+    {
+        BenchmarkInstanceSpin(benchInstanceSpin);
+        return 0;
+    }
+    if (benchLightTiles > 0)
+    {
+        BenchmarkLightTiles(benchLightTiles, threads);
+        return 0;
+    }
+    if (benchRenderState > 0)
+    {
+        BenchmarkRenderState(benchRenderState);
+        return 0;
+    }
+    if (benchEmitters)
+    {
+        BenchmarkEmitters(benchPins, steps);
+        return 0;
+    }
+    if (benchParticleThreads > 0)
+    {
+        BenchmarkParticleThreads(benchParticleThreads);
+        return 0;
+    }
+    if (benchParticleResize)
+    {
+        BenchmarkParticleResize(steps);
+        return 0;
+    }
+    if (particleBudget > 0)
+    {
+        BenchmarkParticleBudget(particleBudget, particleSaturation, steps);
+        return 0;
+    }
+
+    vector<Launch> script;
+    if (rapidFire > 0)
+        script = DefaultScript((int)(steps * timeStep * rapidFire), 1.0f / rapidFire);
+    else
+        script = scriptPath ? LoadScript(scriptPath) : DefaultScript(launches);
+
+    // balls currently in the scene, in order of launch (circular buffer of ballLimit elements)
+    vector<btRigidBody*> liveBalls(ballLimit, nullptr);
+    int oldestBall = 0;
+    unsigned long releasedBalls = 0;
+
+    // instance of the physics class, with the same world of the game
+    Physics bulletSimulation(threads);
+    EntityRegistry registry;
+    CreateLanes(bulletSimulation, registry);
+    CreatePins(bulletSimulation, registry, pinMass, pinMassStep, pinFriction, pinRestitution);
+
+    size_t nextLaunch = 0;
+    double simulationTime = 0.0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; s++)
+    {
+        // we replay all the launches scheduled up to the current simulation time
+        while (nextLaunch < script.size() && script[nextLaunch].time <= simulationTime)
+        {
+            Launch &l = script[nextLaunch++];
+            btRigidBody* ball = LaunchBall(bulletSimulation, registry, l.x, l.z, glm::normalize(l.direction) * shootInitialSpeed);
+
+            // over the limit, the oldest ball is released and its slot is reused by the next launch
+            if (ballLimit > 0)
+            {
+                if (liveBalls[oldestBall])
+                {
+                    registry.Remove(liveBalls[oldestBall]);
+                    bulletSimulation.releaseRigidBody(liveBalls[oldestBall]);
+                    releasedBalls++;
+                }
+                liveBalls[oldestBall] = ball;
+                oldestBall = (oldestBall + 1) % ballLimit;
+            }
+        }
+
+        bulletSimulation.dynamicsWorld->stepSimulation(timeStep, 10);
+        simulationTime += timeStep;
+
+        // as in the game, the bodies fallen from the lanes are retired after the step
+        // the retired balls are removed from the circular buffer, otherwise they would be released twice
+        if (bulletSimulation.CollectOutOfBounds(fallLimit) > 0)
+        {
+            for (int r = 0; r < bulletSimulation.retiredBodies.size(); r++)
+            {
+                registry.Remove(bulletSimulation.retiredBodies[r]);
+                for (int b = 0; b < ballLimit; b++)
+                    if (liveBalls[b] == bulletSimulation.retiredBodies[r])
+                        liveBalls[b] = nullptr;
+            }
+            bulletSimulation.FlushRetired();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Simulated steps: " << steps << " (" << simulationTime << " s of simulation)" << std::endl;
+    std::cout << "Launched balls: " << nextLaunch << " - Released balls: " << releasedBalls << " - Retired bodies: " << bulletSimulation.totalRetired << " - Rigid bodies: " << bulletSimulation.dynamicsWorld->getNumCollisionObjects() << std::endl;
+    std::cout << "Standing pins: " << CountStandingPins(registry) << "/" << planeNum * total_pins << std::endl;
+    std::cout << "Wall time: " << elapsed.count() << " s - Steps/sec: " << (elapsed.count() > 0.0 ? steps / elapsed.count() : 0.0) << std::endl;
+    bulletSimulation.PrintMemoryReport();
+
+    // we delete the data of the physical simulation
+    bulletSimulation.Clear();
+    return 0;
+}
+
+//////////////////////////////////////////
+// default script: a ball on each lane every half second (or every interval seconds), shot from the foul line towards the pins
+// a small lateral deviation, different for each launch, is added to the direction to hit the pins in different ways
+vector<Launch> DefaultScript(int launches, float interval)
+{
+    vector<Launch> script;
+    for (int l = 0; l < launches; l++)
+    {
+        Launch launch;
+        launch.time = interval * l;
+        launch.x = plane_pos.x + (l % planeNum) * laneOffset;
+        launch.z = 12.0f;
+        launch.direction = glm::vec3(0.01f * ((l * 7) % 11 - 5), 0.0f, -1.0f);
+        script.push_back(launch);
+    }
+    return script;
+}
+
+//////////////////////////////////////////
+// script loaded from disk: one launch per line, in the form "time x z dirX dirY dirZ", sorted by time
+vector<Launch> LoadScript(const char* path)
+{
+    vector<Launch> script;
+    ifstream file(path);
+    if (!file)
+    {
+        std::cout << "Failed to open script: " << path << std::endl;
+        return script;
+    }
+
+    string line;
+    while (getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        Launch launch;
+        istringstream values(line);
+        if (values >> launch.time >> launch.x >> launch.z >> launch.direction.x >> launch.direction.y >> launch.direction.z)
+            script.push_back(launch);
+    }
+    return script;
+}
+
+//////////////////////////////////////////
+// a pin is standing if it is still on the lane and its up axis is (almost) vertical
+// the fallen pins have already been retired, and removed from the registry
+int CountStandingPins(EntityRegistry &registry)
+{
+    int standing = 0;
+    std::vector<Entity> &pins = registry.kinds[PIN_ENTITY];
+    for (size_t i = 0; i < pins.size(); i++)
+    {
+        const btTransform &transform = pins[i].body->getWorldTransform();
+        if (transform.getOrigin().getY() > plane_pos.y && transform.getBasis().getColumn(1).getY() > 0.9f)
+            standing++;
+    }
+    return standing;
+}
+
+//////////////////////////////////////////
+// benchmark of the step time of the multithread simulation
+// the same scene is simulated with the sequential version of the Physics class, and then with 1, 2, 4, ... up to maxThreads threads
+void BenchmarkThreads(int maxThreads, int pins, int steps)
+{
+    const btScalar timeStep = 1.0f / 60.0f;
+
+    std::cout << "Pins: " << pins << " - Steps: " << steps << std::endl;
+    std::cout << "threads\tms/step\tspeedup" << std::endl;
+
+    // 0 = sequential simulation, then powers of two up to maxThreads
+    vector<int> threadCounts(1, 0);
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    double sequentialTime = 0.0;
+    for (size_t c = 0; c < threadCounts.size(); c++)
+    {
+        int threads = threadCounts[c];
+        Physics bulletSimulation(threads);
+        EntityRegistry registry;
+        CreatePinField(bulletSimulation, registry, pins);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int s = 0; s < steps; s++)
+            bulletSimulation.dynamicsWorld->stepSimulation(timeStep, 10);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        double stepTime = elapsed.count() / steps;
+        if (threads == 0)
+            sequentialTime = stepTime;
+        std::cout << (threads == 0 ? string("seq") : to_string(bulletSimulation.numThreads)) << "\t" << stepTime << "\t" << sequentialTime / stepTime << std::endl;
+
+        bulletSimulation.Clear();
+    }
+}
+
+//////////////////////////////////////////
+// a large scene for the benchmark: a wide floor with a square grid of pins (with the same size of the pins of the game), and a row of balls shot through them
+void CreatePinField(Physics &physics, EntityRegistry &registry, int pins)
+{
+    // pins of the grid on each side, and distance between them
+    int side = (int)ceil(sqrt((float)pins));
+    float spacing = 0.5f;
+    float halfExtent = side * spacing * 0.5f;
+
+    // the floor is static, and it is larger than the grid to keep the pins on it after the collisions
+    registry.Add(PLANE_ENTITY, physics.createRigidBody(BOX, glm::vec3(0.0f, plane_pos.y, 0.0f), glm::vec3(halfExtent + 10.0f, plane_size.y, halfExtent + 10.0f), plane_rot, 0.0f, 0.2f, 0.2f));
+
+    glm::vec3 pin_rot = glm::vec3(0.0f, 0.0f, 0.0f);
+    for (int p = 0; p < pins; p++)
+    {
+        glm::vec3 pin_pos = glm::vec3(-halfExtent + (p % side) * spacing, 0.0f, -halfExtent + (p / side) * spacing);
+        registry.Add(PIN_ENTITY, physics.createRigidBody(BOX, pin_pos, pin_size, pin_rot, 1.5f, 0.5f, 0.5f));
+    }
+
+    // a ball every two columns, shot along the grid
+    for (int b = 0; b < side; b += 2)
+        LaunchBall(physics, registry, -halfExtent + b * spacing, halfExtent + 2.0f, glm::vec3(0.0f, 0.0f, -shootInitialSpeed));
+}
+
+//////////////////////////////////////////
+// benchmark of the CPU time of the particles: at each frame, new particles are requested, all the particles are updated by the particle system (update),
+// and then the alive particles are packed in the interleaved vertex array uploaded in the VBO (submit)
+// the spawn rate keeps about 80% of the particles alive, as in the game when the pool is almost full
+// N.B.) the upload in the VBO and the draw call are not measured here (they need an OpenGL context): the game shows the complete submit time in the ImGui window
+void BenchmarkParticles()
+{
+    const int sizes[] = {500, 10000, 100000};
+    const int frames = 1000;
+    const float deltaTime = 1.0f / 60.0f;
+
+    std::cout << "particles\talive\tupdate ms/frame\tsubmit ms/frame\tbytes/frame\tdraw calls" << std::endl;
+    for (int n = 0; n < 3; n++)
+    {
+        ParticleSystem particleSystem(sizes[n]);
+        vector<ParticleVertex> vertices;
+        // particles live 1 second
+        int spawnsPerFrame = (int)(sizes[n] * 0.8f * deltaTime);
+        if (spawnsPerFrame < 1)
+            spawnsPerFrame = 1;
+
+        size_t alive = 0;
+        double updateTime = 0.0, submitTime = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            for (int s = 0; s < spawnsPerFrame; s++)
+                particleSystem.Spawn(glm::vec3(rand() % 100, rand() % 100, rand() % 100), glm::vec3(0.0f, -0.1f, 0.0f), glm::vec4(1.0f));
+            particleSystem.Update(deltaTime);
+            updateTime += particleSystem.updateTime;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            alive = particleSystem.Pack(vertices);
+            submitTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // a single draw call for all the particles (before, there was one for each alive particle)
+        std::cout << sizes[n] << "\t" << alive << "\t" << updateTime / frames << "\t" << submitTime / frames << "\t" << alive * sizeof(ParticleVertex) << "\t1 (was " << alive << ")" << std::endl;
+    }
+}
+
+// a particle in the previous layout (array of structures), used as reference by BenchmarkParticleLayout
+struct Particle {
+    glm::vec3 Position;
+    glm::vec3 Speed;
+    glm::vec4 Color;
+    float     Life;
+};
+
+//////////////////////////////////////////
+// benchmark of the update of the particles: the previous loop on the array of structures (scalar GLM math), and the kernel on the structure of arrays (IntegrateParticles)
+// both the layouts start from the same particles, and they must give the same alive particles at the end
+void BenchmarkParticleLayout()
+{
+    const int sizes[] = {10000, 100000, 1000000};
+    const int frames = 200;
+    const float deltaTime = 1.0f / 60.0f;
+
+#ifdef PARTICLES_SSE
+    std::cout << "kernel: SSE" << std::endl;
+#elif defined(PARTICLES_NEON)
+    std::cout << "kernel: NEON" << std::endl;
+#else
+    std::cout << "kernel: scalar" << std::endl;
+#endif
+    std::cout << "particles\tAoS ms/frame\tSoA ms/frame\tspeedup\talive AoS/SoA" << std::endl;
+    for (int n = 0; n < 3; n++)
+    {
+        vector<Particle> particles(sizes[n]);
+        ParticleStore store;
+        store.Allocate(sizes[n]);
+        for (int i = 0; i < sizes[n]; i++)
+        {
+            Particle &p = particles[i];
+            p.Position = glm::vec3(rand() % 100, rand() % 100, rand() % 100);
+            p.Speed = glm::vec3((rand() % 100) / 100.0f, (rand() % 100) / 100.0f, (rand() % 100) / 100.0f);
+            p.Color = glm::vec4(1.0f);
+            // lifetimes longer than the benchmark, so most of the particles remain alive
+            p.Life = (rand() % 500) / 100.0f;
+
+            store.posX[i] = p.Position.x; store.posY[i] = p.Position.y; store.posZ[i] = p.Position.z;
+            store.speedX[i] = p.Speed.x; store.speedY[i] = p.Speed.y; store.speedZ[i] = p.Speed.z;
+            store.colorR[i] = p.Color.r; store.colorG[i] = p.Color.g; store.colorB[i] = p.Color.b; store.colorA[i] = p.Color.a;
+            store.life[i] = p.Life;
+        }
+
+        // array of structures
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++)
+        {
+            for (size_t i = 0; i < particles.size(); ++i)
+            {
+                Particle &p = particles[i];
+                p.Life -= deltaTime;
+                if (p.Life > 0.0f)
+                {
+                    p.Position -= p.Speed * deltaTime;
+                    p.Color.a -= deltaTime * 2.5f;
+                }
+            }
+        }
+        double aosTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+
+        // structure of arrays
+        start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++)
+            IntegrateParticles(store, 0, store.capacity, deltaTime);
+        double soaTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+
+        int aliveAoS = 0, aliveSoA = 0;
+        for (int i = 0; i < sizes[n]; i++)
+        {
+            aliveAoS += (particles[i].Life > 0.0f);
+            aliveSoA += (store.life[i] > 0.0f);
+        }
+        std::cout << sizes[n] << "\t" << aosTime << "\t" << soaTime << "\t" << aosTime / soaTime << "\t" << aliveAoS << "/" << aliveSoA << std::endl;
+    }
+}
+
+//////////////////////////////////////////
+// benchmark of the particle system when more particles are requested than its budget: 1.5 * budget particles per second, each one living 1 second
+// the spawns and the kills take constant time, so the update time depends only on the alive particles
+void BenchmarkParticleBudget(int budget, ParticleSaturation saturation, int frames)
+{
+    const float deltaTime = 1.0f / 60.0f;
+    const char* policies[] = {"drop", "steal", "grow"};
+
+    ParticleSystem particleSystem(budget, saturation);
+    int spawnsPerFrame = (int)(budget * 1.5f * deltaTime) + 1;
+
+    double updateTime = 0.0;
+    for (int f = 0; f < frames; f++)
+    {
+        for (int s = 0; s < spawnsPerFrame; s++)
+            particleSystem.Spawn(glm::vec3(rand() % 100, rand() % 100, rand() % 100), glm::vec3(0.0f, -0.1f, 0.0f), glm::vec4(1.0f));
+        particleSystem.Update(deltaTime);
+        updateTime += particleSystem.updateTime;
+    }
+
+    std::cout << "Budget: " << budget << " - Policy: " << policies[saturation] << " - Frames: " << frames << " - Requests: " << (unsigned long)spawnsPerFrame * frames << std::endl;
+    std::cout << "Alive particles: " << particleSystem.Count() << " - Final budget: " << particleSystem.particleNum << " - Capacity: " << particleSystem.store.capacity << std::endl;
+    std::cout << "Dropped spawns: " << particleSystem.droppedSpawns << " - Stolen particles: " << particleSystem.stolenSpawns << std::endl;
+    std::cout << "Update: " << updateTime / frames << " ms/frame" << std::endl;
+}
+
+//////////////////////////////////////////
+// benchmark of the changes of the budget at runtime: every 60 frames the budget moves to the next value of a cycle from 500 to 100k and back
+// the particles are requested at 1.5 times the largest budget per second, so the budget is always full
+// after the first cycle, the store has reached its largest capacity, and it is never reallocated again
+void BenchmarkParticleResize(int frames)
+{
+    const int budgets[] = {500, 5000, 50000, 100000, 20000, 2000, 500, 100000, 10};
+    const int numBudgets = sizeof(budgets) / sizeof(budgets[0]);
+    const float deltaTime = 1.0f / 60.0f;
+
+    ParticleSystem particleSystem(budgets[0]);
+    int spawnsPerFrame = (int)(100000 * 1.5f * deltaTime);
+
+    double updateTime = 0.0, resizeTime = 0.0, maxResizeTime = 0.0;
+    bool withinBudget = true;
+    std::cout << "frame\tbudget\talive\tcapacity\treallocations" << std::endl;
+    for (int f = 0; f < frames; f++)
+    {
+        if (f % 60 == 0)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            particleSystem.SetBudget(budgets[(f / 60) % numBudgets]);
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            resizeTime += elapsed;
+            maxResizeTime = (elapsed > maxResizeTime) ? elapsed : maxResizeTime;
+        }
+
+        for (int s = 0; s < spawnsPerFrame; s++)
+            particleSystem.Spawn(glm::vec3(rand() % 100, rand() % 100, rand() % 100), glm::vec3(0.0f, -0.1f, 0.0f), glm::vec4(1.0f));
+        particleSystem.Update(deltaTime);
+        updateTime += particleSystem.updateTime;
+        // the alive particles never exceed the budget
+        withinBudget = withinBudget && (particleSystem.Count() <= particleSystem.particleNum);
+
+        if (f % 60 == 59)
+            std::cout << f << "\t" << particleSystem.particleNum << "\t" << particleSystem.Count() << "\t" << particleSystem.store.capacity << "\t" << particleSystem.reallocations << std::endl;
+    }
+
+    std::cout << "Update: " << updateTime / frames << " ms/frame - Budget changes: " << resizeTime << " ms total, " << maxResizeTime << " ms max" << std::endl;
+    std::cout << "Alive particles always within the budget: " << (withinBudget ? "yes" : "no") << std::endl;
+}
+
+//////////////////////////////////////////
+// benchmark of the multithread update of the particles: 1M particles are created (always with the same random values), and then updated for 50 frames
+// (less than their lifetime, so they are all alive), first on the calling thread, and then with the job system
+// the particles updated by the threads must be identical to the ones updated by the calling thread
+void BenchmarkParticleThreads(int maxThreads)
+{
+    const int numParticles = 1000000;
+    const int frames = 50;
+    const float deltaTime = 1.0f / 60.0f;
+
+    std::cout << "Particles: " << numParticles << " - Frames: " << frames << std::endl;
+    std::cout << "threads\tms/frame\tspeedup\tidentical" << std::endl;
+
+    // 0 = calling thread only, then powers of two up to maxThreads
+    vector<int> threadCounts(1, 0);
+    for (int t = 1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    vector<float> reference;
+    double sequentialTime = 0.0;
+    for (size_t c = 0; c < threadCounts.size(); c++)
+    {
+        int threads = threadCounts[c];
+        JobSystem jobSystem(threads > 0 ? threads : 1);
+        ParticleSystem particleSystem(numParticles);
+        if (threads > 0)
+            particleSystem.jobs = &jobSystem;
+
+        srand(1);
+        for (int i = 0; i < numParticles; i++)
+            particleSystem.Spawn(glm::vec3(rand() % 100, rand() % 100, rand() % 100), glm::vec3((rand() % 100) / 100.0f, (rand() % 100) / 100.0f, (rand() % 100) / 100.0f), glm::vec4(1.0f));
+
+        double updateTime = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            particleSystem.Update(deltaTime);
+            // the first update includes the creation of the particles
+            if (f > 0)
+                updateTime += particleSystem.updateTime;
+        }
+        updateTime /= (frames - 1);
+
+        // the positions and the colors of the particles are compared with the update on the calling thread
+        vector<ParticleVertex> vertices;
+        size_t alive = particleSystem.Pack(vertices);
+        const float* data = (const float*)vertices.data();
+        vector<float> result(data, data + alive * sizeof(ParticleVertex) / sizeof(float));
+        if (threads == 0)
+        {
+            reference = result;
+            sequentialTime = updateTime;
+        }
+
+        std::cout << (threads == 0 ? string("seq") : to_string(jobSystem.NumThreads())) << "\t" << updateTime << "\t" << sequentialTime / updateTime << "\t" << (result == reference ? "yes" : "NO") << std::endl;
+    }
+}
+
+//////////////////////////////////////////
+// benchmark of the emitters of particles: the balls are shot through a field of pins, and only the moving bodies emit particles
+// the emission is capped by the budget of the particle system (the default 500 particles of the game), so the alive particles remain stable
+// independently of the number of moving bodies
+void BenchmarkEmitters(int pins, int steps)
+{
+    const btScalar timeStep = 1.0f / 60.0f;
+
+    Physics bulletSimulation;
+    EntityRegistry registry;
+    SetupEmitters(registry);
+    CreatePinField(bulletSimulation, registry, pins);
+
+    ParticleSystem particleSystem(500);
+    unsigned long emitted = 0;
+
+    std::cout << "Pins: " << pins << " - Balls: " << registry.Count(BALL_ENTITY) << " - Particle budget: " << particleSystem.particleNum << std::endl;
+    std::cout << "second\tmoving\trequested/s\temitted/s\talive\tupdate ms" << std::endl;
+    for (int s = 0; s < steps; s++)
+    {
+        bulletSimulation.dynamicsWorld->stepSimulation(timeStep, 10);
+
+        // the moving pins and balls emit particles from their positions
+        int moving = 0;
+        for (int kind = PIN_ENTITY; kind <= BALL_ENTITY; kind++)
+        {
+            vector<Entity> &entities = registry.kinds[kind];
+            for (size_t e = 0; e < entities.size(); e++)
+            {
+                btRigidBody* body = entities[e].body;
+                float speed = body->getLinearVelocity().length();
+                moving += (speed > entities[e].emitter.minSpeed);
+                int n = particleSystem.Emit(entities[e].emitter, speed, timeStep);
+                btVector3 pos = body->getWorldTransform().getOrigin();
+                for (int i = 0; i < n; i++)
+                    particleSystem.Spawn(glm::vec3(pos.getX(), pos.getY(), pos.getZ()), glm::vec3(0.0f), glm::vec4(1.0f));
+                emitted += n;
+            }
+        }
+        particleSystem.Update(timeStep);
+
+        if (s % 60 == 59)
+        {
+            std::cout << (s + 1) / 60 << "\t" << moving << "\t" << particleSystem.requestedRate << "\t" << emitted << "\t" << particleSystem.Count() << "\t" << particleSystem.updateTime << std::endl;
+            emitted = 0;
+        }
+    }
+
+    bulletSimulation.Clear();
+}
+
+//////////////////////////////////////////
+// benchmark of the frustum culling: the instances are cubes (radius sqrt(3), as cube.obj) with random positions, scales and rotations around the camera,
+// which looks along the -z axis with the projection of the game: about 1/8 of them are visible
+void BenchmarkCulling(int instances, int threads)
+{
+    const int frames = 20;
+    const float cubeRadius = sqrt(3.0f);
+
+    // the instances fill a cube centered on the camera, with about 1 instance every 8 cubic units
+    float side = 2.0f * pow((float)instances, 1.0f / 3.0f);
+    vector<glm::mat4> matrices(instances);
+    srand(1);
+    for (int i = 0; i < instances; i++)
+    {
+        glm::vec3 pos = glm::vec3((rand() % 10000) / 10000.0f - 0.5f, (rand() % 10000) / 10000.0f - 0.5f, (rand() % 10000) / 10000.0f - 0.5f) * side;
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), pos);
+        model = glm::scale(model, glm::vec3((rand() % 40) / 100.0f + 0.1f));
+        matrices[i] = glm::rotate(model, (float)(rand() % 360), glm::vec3(0.4f, 0.6f, 0.8f));
+    }
+    glm::mat4 projection = glm::perspective(45.0f, 1200.0f / 900.0f, 0.1f, 10000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 clip = projection * view;
+
+    vector<glm::mat4> reference(instances), visible(instances);
+    std::cout << "Instances: " << instances << std::endl;
+    std::cout << "test\tvisible\tms/frame\tidentical" << std::endl;
+
+    // scalar test of each sphere (computed from the matrix at each frame, as a simple implementation would do)
+    InstanceCuller culler;
+    culler.SetInstances(matrices.data(), instances, cubeRadius);
+    int referenceCount = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++)
+    {
+        Frustum frustum(clip);
+        referenceCount = 0;
+        for (int i = 0; i < instances; i++)
+        {
+            const glm::mat4 &m = matrices[i];
+            float scale = glm::max(glm::length(glm::vec3(m[0])), glm::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+            if (frustum.IsSphereVisible(glm::vec3(m[3]), cubeRadius * scale))
+                reference[referenceCount++] = m;
+        }
+    }
+    std::cout << "scalar\t" << referenceCount << "\t" << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames << "\t-" << std::endl;
+
+    // SIMD test, on the calling thread and then on the job system
+    JobSystem jobSystem(threads);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        culler.jobs = (pass == 0) ? NULL : &jobSystem;
+        double cullTime = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            culler.Cull(clip, matrices.data(), instances, visible.data());
+            cullTime += culler.cullTime;
+        }
+        bool identical = (culler.visibleCount == referenceCount) && equal(visible.begin(), visible.begin() + referenceCount, reference.begin());
+        std::cout << (pass == 0 ? string("simd") : "simd x" + to_string(jobSystem.NumThreads())) << "\t" << culler.visibleCount << "\t" << cullTime / frames << "\t" << (identical ? "yes" : "NO") << std::endl;
+    }
+}
+
+//////////////////////////////////////////
+// benchmark of the streaming of the background instances: the main thread simulates frames of 16 ms, as the game does while the instances are generated
+void BenchmarkInstanceStream(int instances, int threads)
+{
+    // same upload budget and camera of the game
+    const int uploadBudget = 65536;
+    const unsigned int seed = 1;
+    const float cubeRadius = sqrt(3.0f);
+    glm::mat4 projection = glm::perspective(45.0f, 1200.0f / 900.0f, 0.1f, 10000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 7.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 clip = projection * view * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -50.0f));
+
+    JobSystem jobSystem(threads);
+    InstanceCuller culler;
+    culler.jobs = &jobSystem;
+    vector<InstanceTransform> streamed, staging, reference(instances);
+    vector<unsigned int> visible;
+
+    std::cout << "Instances: " << instances << " - upload budget: " << uploadBudget << " instances/frame" << std::endl;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    InstanceGenerator generator(BackgroundInstance, seed, &jobSystem);
+    generator.Request(instances);
+    int frames = 0;
+    double maxFrameTime = 0.0, totalFrameTime = 0.0;
+    while ((int)streamed.size() < instances)
+    {
+        // work of the main thread in a frame: upload of the new instances, and culling
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        staging.clear();
+        int n = generator.TakeBatches(staging, uploadBudget);
+        culler.AddInstances(staging.data(), n, cubeRadius);
+        visible.resize(culler.numInstances);
+        culler.CullIndices(clip, culler.numInstances, visible.data());
+        double frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        maxFrameTime = std::max(maxFrameTime, frameTime);
+        totalFrameTime += frameTime;
+        frames++;
+        // the instances are kept (outside the measured time) for the final check
+        streamed.insert(streamed.end(), staging.begin(), staging.end());
+
+        // the rest of the frame
+        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+    }
+    double streamTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // the same instances generated on a single thread, in a single call
+    InstanceGenerator::Generate(BackgroundInstance, seed, 0, instances, reference.data());
+    bool identical = !memcmp(streamed.data(), reference.data(), instances * sizeof(InstanceTransform));
+
+    std::cout << "frames\tstream ms\tframe ms (avg)\tframe ms (max)\tvisible\tidentical" << std::endl;
+    std::cout << frames << "\t" << streamTime << "\t" << totalFrameTime / frames << "\t" << maxFrameTime << "\t" << culler.visibleCount << "\t" << (identical ? "yes" : "NO") << std::endl;
+}
+
+//////////////////////////////////////////
+// previous generation of the background: a serial loop with rand(), and the products of the translation, scale and rotation matrices
+void GenerateBackgroundWithRand(vector<glm::mat4> &matrices)
+{
+    float offset = 6.0f;
+    for (int index = 0; index < (int)matrices.size(); index++)
+    {
+        int i = index % backgroundLayerSize;
+        glm::mat4 model = glm::mat4(1.0f);
+        float displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
+        float x = (i % 2 == 0) ? -90.0f + (0.0165f * i) + displacement + 5.0f : 90.0f - (0.0165f * i) - displacement - 5.0f;
+        displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
+        float y = -33.0f + (0.0165f * i) + displacement;
+        float z = displacement * 2.0f - (index / backgroundLayerSize) * backgroundLayerDistance;
+        float scale = static_cast<float>((rand() % 40) / 100.0 + 0.1);
+        float rotAngle = static_cast<float>((rand() % 360));
+        model = glm::translate(model, glm::vec3(x, y, z));
+        model = glm::scale(model, glm::vec3(scale));
+        model = glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
+        matrices[index] = model;
+    }
+}
+
+//////////////////////////////////////////
+// benchmark of the generation of the background at startup, with 10k, 100k, 1M and 10M instances
+void BenchmarkInstanceGeneration(int threads)
+{
+    const int sizes[] = { 10000, 100000, 1000000, 10000000 };
+    const unsigned int seed = 1;
+    JobSystem jobSystem(threads);
+
+    std::cout << "instances\trand() ms\tcounter ms\tcounter x" << jobSystem.NumThreads() << " ms\tspeedup\tidentical" << std::endl;
+    for (int n = 0; n < 4; n++)
+    {
+        vector<glm::mat4> matrices(sizes[n]);
+        vector<InstanceTransform> serial(sizes[n]), parallel(sizes[n]);
+
+        srand(seed);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        GenerateBackgroundWithRand(matrices);
+        double randTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        InstanceGenerator::Generate(BackgroundInstance, seed, 0, sizes[n], serial.data());
+        double serialTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        InstanceGenerator::Generate(BackgroundInstance, seed, 0, sizes[n], parallel.data(), &jobSystem);
+        double parallelTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        bool identical = !memcmp(serial.data(), parallel.data(), sizes[n] * sizeof(InstanceTransform));
+        std::cout << sizes[n] << "\t" << randTime << "\t" << serialTime << "\t" << parallelTime << "\t" << randTime / parallelTime << "\t" << (identical ? "yes" : "NO") << std::endl;
+    }
+}
+
+//////////////////////////////////////////
+// maximum distance between the vertices of the cube (cube.obj, corners in [-1, 1]) transformed by the matrices a and b
+float MaxCubeError(const glm::mat4 &a, const glm::mat4 &b)
+{
+    float error = 0.0f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec4 v = glm::vec4((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f, 1.0f);
+        error = std::max(error, glm::length(glm::vec3(a * v) - glm::vec3(b * v)));
+    }
+    return error;
+}
+
+//////////////////////////////////////////
+// matrix of an instance at a time, built with the GLM functions (translate * scale * spin * rotate), independently of InstanceTransform::Matrix
+glm::mat4 ReferenceMatrix(const InstanceTransform &t, float time)
+{
+    glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), t.position), glm::vec3(t.scale));
+    float speed = glm::length(glm::vec3(t.spin));
+    if (speed > 0.0f)
+        model = glm::rotate(model, t.spin.w + speed * time, glm::vec3(t.spin));
+    return model * glm::mat4_cast(glm::quat(t.rotation.w, t.rotation.x, t.rotation.y, t.rotation.z));
+}
+
+//////////////////////////////////////////
+// benchmark of the encodings of the instances: the reference matrices are built with the GLM functions (translate * scale * rotate), as the previous version did
+void BenchmarkInstanceEncoding(int instances)
+{
+    const int uploadBudget = 65536;
+    vector<InstanceTransform> transforms(instances);
+    InstanceGenerator::Generate(BackgroundInstance, 1, 0, instances, transforms.data());
+    InstanceQuantizer quantizer = BackgroundQuantizer(instances);
+
+    // full matrices
+    vector<glm::mat4> matrices(instances);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < instances; i++)
+        matrices[i] = ReferenceMatrix(transforms[i], 0.0f);
+    double matrixTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // quantized transformations
+    vector<QuantizedTransform> quantized(instances);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < instances; i++)
+        quantized[i] = quantizer.Quantize(transforms[i]);
+    double quantizeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // errors of the matrices rebuilt by the shader (InstanceTransform::Matrix is the same computation)
+    float compactError = 0.0f, quantizedError = 0.0f;
+    for (int i = 0; i < instances; i++)
+    {
+        compactError = std::max(compactError, MaxCubeError(matrices[i], transforms[i].Matrix()));
+        quantizedError = std::max(quantizedError, MaxCubeError(matrices[i], quantizer.Dequantize(quantized[i]).Matrix()));
+    }
+
+    const char* names[] = { "mat4", "compact", "quantized" };
+    const int sizes[] = { sizeof(glm::mat4), sizeof(InstanceTransform), sizeof(QuantizedTransform) };
+    const double times[] = { matrixTime, 0.0, quantizeTime };
+    const float errors[] = { 0.0f, compactError, quantizedError };
+    std::cout << "Instances: " << instances << " - bounds of the quantization: " << quantizer.boundsSize.x << " x " << quantizer.boundsSize.y << " x " << quantizer.boundsSize.z << std::endl;
+    std::cout << "encoding\tbytes\tbuffer MB\tMB/frame\tencode ms\tmax error" << std::endl;
+    for (int e = 0; e < 3; e++)
+        std::cout << names[e] << "\t" << sizes[e] << "\t" << (double)sizes[e] * instances / (1024.0 * 1024.0) << "\t" << (double)sizes[e] * std::min(instances, uploadBudget) / (1024.0 * 1024.0)
+                  << "\t" << times[e] << "\t" << errors[e] << std::endl;
+}
+
+//////////////////////////////////////////
+// verification of the spin animation: for each time, maximum error of the vertices of the cube, between the reference implementation of the shader and the GLM matrices
+// (for the quantized encoding, the GLM matrices of the dequantized transformations, as read by the shader)
+void BenchmarkInstanceSpin(int instances)
+{
+    const float times[] = { 0.0f, 1.0f, 10.0f, 100.0f, 1000.0f };
+    vector<InstanceTransform> transforms(instances), dequantized(instances);
+    InstanceGenerator::Generate(BackgroundInstance, 1, 0, instances, transforms.data());
+    InstanceQuantizer quantizer = BackgroundQuantizer(instances);
+    for (int i = 0; i < instances; i++)
+        dequantized[i] = quantizer.Dequantize(quantizer.Quantize(transforms[i]));
+
+    std::cout << "Instances: " << instances << std::endl;
+    std::cout << "time s\tcompact error\tquantized error\tquantization drift" << std::endl;
+    for (int t = 0; t < 5; t++)
+    {
+        // the drift is the difference between the quantized and the float animation
+        float compactError = 0.0f, quantizedError = 0.0f, drift = 0.0f;
+        for (int i = 0; i < instances; i++)
+        {
+            glm::mat4 animated = transforms[i].Matrix(times[t]);
+            compactError = std::max(compactError, MaxCubeError(animated, ReferenceMatrix(transforms[i], times[t])));
+            quantizedError = std::max(quantizedError, MaxCubeError(dequantized[i].Matrix(times[t]), ReferenceMatrix(dequantized[i], times[t])));
+            drift = std::max(drift, MaxCubeError(animated, dequantized[i].Matrix(times[t])));
+        }
+        std::cout << times[t] << "\t" << compactError << "\t" << quantizedError << "\t" << drift << std::endl;
+    }
+
+    // animation on the CPU: the matrices of all the instances are computed and uploaded at each frame
+    const int frames = 10;
+    vector<glm::mat4> matrices(instances);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++)
+        for (int i = 0; i < instances; i++)
+            matrices[i] = transforms[i].Matrix(f / 60.0f);
+    double cpuTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    std::cout << "CPU animation: " << cpuTime << " ms/frame + " << (double)instances * sizeof(glm::mat4) / (1024.0 * 1024.0) << " MB/frame of upload" << std::endl;
+    std::cout << "GPU animation: 0 ms/frame + 0 MB/frame of upload (" << (double)instances * sizeof(QuantizedTransform) / (1024.0 * 1024.0) << " MB uploaded once, quantized)" << std::endl;
+}
+
+//////////////////////////////////////////
+// benchmark of the assignment of the lights to the screen tiles: the lights move above the lanes, in front of the camera of the game
+void BenchmarkLightTiles(int lights, int threads)
+{
+    const int frames = 20;
+    const int width = 1200, height = 900;
+    glm::mat4 projection = glm::perspective(45.0f, (float)width / (float)height, 0.1f, 10000.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(5.0f, 1.0f, 12.0f), glm::vec3(5.0f, 1.0f, 11.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // lights with a random range of 1.5-4 units, in a volume of 20 x 4 x 50 units in front of the camera
+    vector<PointLight> pointLights(lights);
+    for (int i = 0; i < lights; i++)
+    {
+        CounterRandom random(1, (uint32_t)i);
+        pointLights[i].position = glm::vec3(-5.0f + 20.0f * random.Uniform(), -1.0f + 4.0f * random.Uniform(), -40.0f + 50.0f * random.Uniform());
+        pointLights[i].radius = 1.5f + 2.5f * random.Uniform();
+        pointLights[i].color = glm::vec3(1.0f);
+        pointLights[i].intensity = 1.0f;
+    }
+
+    LightTiler tiler;
+    int tilesX = (width + tiler.tileSize - 1) / tiler.tileSize, tilesY = (height + tiler.tileSize - 1) / tiler.tileSize;
+    int tiles = tilesX * tilesY;
+    std::cout << "Lights: " << lights << " - tiles: " << tilesX << " x " << tilesY << std::endl;
+    std::cout << "test	avg lights/tile	max lights/tile	ms/frame	identical" << std::endl;
+
+    // scalar test of each light against the frustum of each tile
+    vector<vector<int> > reference(tiles);
+    size_t referenceCount = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; f++)
+    {
+        referenceCount = 0;
+        for (int t = 0; t < tiles; t++)
+        {
+            Frustum frustum = tiler.TileFrustum(projection, width, height, t % tilesX, t / tilesX);
+            reference[t].clear();
+            for (int i = 0; i < lights; i++)
+                if (frustum.IsSphereVisible(glm::vec3(view * glm::vec4(pointLights[i].position, 1.0f)), pointLights[i].radius))
+                    reference[t].push_back(i);
+            referenceCount += reference[t].size();
+        }
+    }
+    double scalarTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    size_t referenceMax = 0;
+    for (int t = 0; t < tiles; t++)
+        referenceMax = std::max(referenceMax, reference[t].size());
+    std::cout << "scalar\t" << (double)referenceCount / tiles << "\t" << referenceMax << "\t" << scalarTime << "\t-" << std::endl;
+
+    // SIMD test, on the calling thread and then on the job system
+    JobSystem jobSystem(threads);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        tiler.jobs = (pass == 0) ? NULL : &jobSystem;
+        double cullTime = 0.0;
+        for (int f = 0; f < frames; f++)
+        {
+            tiler.Cull(pointLights.data(), lights, view, projection, width, height);
+            cullTime += tiler.cullTime;
+        }
+        bool identical = (tiler.lightIndices.size() == referenceCount);
+        for (int t = 0; t < tiles && identical; t++)
+        {
+            identical = (tiler.tileRanges[2 * t + 1] == reference[t].size());
+            for (size_t k = 0; k < reference[t].size() && identical; k++)
+                identical = (tiler.lightIndices[tiler.tileRanges[2 * t] + k] == reference[t][k]);
+        }
+        std::cout << (pass == 0 ? string("simd") : "simd x" + to_string(jobSystem.NumThreads())) << "\t" << (double)tiler.lightIndices.size() / tiles << "\t" << tiler.maxTileLights << "\t" << cullTime / frames << "\t" << (identical ? "yes" : "NO") << std::endl;
+    }
+    size_t uploadBytes = tiler.viewLights.size() * sizeof(PointLight) + tiler.tileRanges.size() * sizeof(uint32_t) + tiler.lightIndices.size() * sizeof(uint16_t);
+    std::cout << "Upload: " << uploadBytes << " bytes/frame" << std::endl;
+}
+
+/////////////////// recording stub of the OpenGL functions ///////////////////////
+// state of the stub: the values set by the calls received, as the driver would keep them
+struct RecordedState
+{
+    GLuint program;
+    // subroutine indices of each stage of the current program (reset by glUseProgram)
+    std::map<GLenum, vector<GLuint> > subroutines;
+    GLuint activeUnit;
+    // texture bound to each unit and target
+    std::map<std::pair<GLuint, GLenum>, GLuint> textures;
+    GLuint vertexArray;
+    GLenum blendSource, blendDestination;
+    std::map<GLenum, bool> capabilities;
+    GLfloat pointSize;
+
+    // initial state of a context
+    RecordedState() : program(0), activeUnit(0), vertexArray(0), blendSource(GL_ONE), blendDestination(GL_ZERO), pointSize(1.0f)
+    {}
+
+    // the state seen by a draw call (the textures unbound are equal to the ones never bound)
+    bool operator==(const RecordedState &other) const
+    {
+        return program == other.program && subroutines == other.subroutines && vertexArray == other.vertexArray && blendSource == other.blendSource && blendDestination == other.blendDestination &&
+               capabilities == other.capabilities && pointSize == other.pointSize && BoundTextures() == other.BoundTextures();
+    }
+
+    std::map<std::pair<GLuint, GLenum>, GLuint> BoundTextures() const
+    {
+        std::map<std::pair<GLuint, GLenum>, GLuint> bound;
+        for (std::map<std::pair<GLuint, GLenum>, GLuint>::const_iterator t = textures.begin(); t != textures.end(); ++t)
+            if (t->second != 0)
+                bound.insert(*t);
+        return bound;
+    }
+};
+
+// a draw call received by the stub: the state seen by the draw call, and its parameters
+struct RecordedDraw
+{
+    RecordedState state;
+    GLenum mode;
+    GLsizei count, instances;
+
+    bool operator==(const RecordedDraw &other) const
+    {
+        return state == other.state && mode == other.mode && count == other.count && instances == other.instances;
+    }
+};
+
+// kinds of calls recorded by the stub (the same kinds counted by the RenderState, plus the draw calls)
+enum RecordedCalls { RECORDED_PROGRAM, RECORDED_SUBROUTINE, RECORDED_ACTIVE_TEXTURE, RECORDED_TEXTURE, RECORDED_VERTEX_ARRAY, RECORDED_BLEND, RECORDED_CAPABILITY, RECORDED_POINT_SIZE, RECORDED_DRAW, NUM_RECORDED_CALLS };
+
+// current state of the stub, calls received, and state seen by each draw call
+RecordedState recordedState;
+unsigned long recordedCalls[NUM_RECORDED_CALLS];
+vector<RecordedDraw> recordedDraws;
+
+void APIENTRY RecordUseProgram(GLuint program)
+{
+    recordedState.program = program;
+    recordedState.subroutines.clear();
+    recordedCalls[RECORDED_PROGRAM]++;
+}
+void APIENTRY RecordUniformSubroutines(GLenum stage, GLsizei count, const GLuint* indices)
+{
+    recordedState.subroutines[stage].assign(indices, indices + count);
+    recordedCalls[RECORDED_SUBROUTINE]++;
+}
+void APIENTRY RecordActiveTexture(GLenum unit)
+{
+    recordedState.activeUnit = unit - GL_TEXTURE0;
+    recordedCalls[RECORDED_ACTIVE_TEXTURE]++;
+}
+void APIENTRY RecordBindTexture(GLenum target, GLuint texture)
+{
+    recordedState.textures[std::make_pair(recordedState.activeUnit, target)] = texture;
+    recordedCalls[RECORDED_TEXTURE]++;
+}
+void APIENTRY RecordBindVertexArray(GLuint vertexArray)
+{
+    recordedState.vertexArray = vertexArray;
+    recordedCalls[RECORDED_VERTEX_ARRAY]++;
+}
+void APIENTRY RecordBlendFunc(GLenum source, GLenum destination)
+{
+    recordedState.blendSource = source;
+    recordedState.blendDestination = destination;
+    recordedCalls[RECORDED_BLEND]++;
+}
+void APIENTRY RecordEnable(GLenum capability)
+{
+    recordedState.capabilities[capability] = true;
+    recordedCalls[RECORDED_CAPABILITY]++;
+}
+void APIENTRY RecordDisable(GLenum capability)
+{
+    recordedState.capabilities[capability] = false;
+    recordedCalls[RECORDED_CAPABILITY]++;
+}
+void APIENTRY RecordPointSize(GLfloat size)
+{
+    recordedState.pointSize = size;
+    recordedCalls[RECORDED_POINT_SIZE]++;
+}
+void APIENTRY RecordDrawElementsInstanced(GLenum mode, GLsizei count, GLenum, const void*, GLsizei instances)
+{
+    RecordedDraw draw = { recordedState, mode, count, instances };
+    recordedDraws.push_back(draw);
+    recordedCalls[RECORDED_DRAW]++;
+}
+void APIENTRY RecordDrawArrays(GLenum mode, GLint, GLsizei count)
+{
+    RecordedDraw draw = { recordedState, mode, count, 1 };
+    recordedDraws.push_back(draw);
+    recordedCalls[RECORDED_DRAW]++;
+}
+
+// the pointers of the loader, used by utils/render_state.h and by the render passes (see render_passes.h), point to the stub
+PFNGLUSEPROGRAMPROC glad_glUseProgram = RecordUseProgram;
+PFNGLUNIFORMSUBROUTINESUIVPROC glad_glUniformSubroutinesuiv = RecordUniformSubroutines;
+PFNGLACTIVETEXTUREPROC glad_glActiveTexture = RecordActiveTexture;
+PFNGLBINDTEXTUREPROC glad_glBindTexture = RecordBindTexture;
+PFNGLBINDVERTEXARRAYPROC glad_glBindVertexArray = RecordBindVertexArray;
+PFNGLBLENDFUNCPROC glad_glBlendFunc = RecordBlendFunc;
+PFNGLENABLEPROC glad_glEnable = RecordEnable;
+PFNGLDISABLEPROC glad_glDisable = RecordDisable;
+PFNGLPOINTSIZEPROC glad_glPointSize = RecordPointSize;
+PFNGLDRAWELEMENTSINSTANCEDPROC glad_glDrawElementsInstanced = RecordDrawElementsInstanced;
+PFNGLDRAWARRAYSPROC glad_glDrawArrays = RecordDrawArrays;
+
+//////////////////////////////////////////
+// the reference for the render passes: the same passes, with the calls of the rendering loop before the cache of the state
+// (each mesh binds and detaches its VAO, each texture is bound after its unit is activated, and the subroutine is set after each glUseProgram)
+unsigned int RenderPassesDirect(const FrameObjects &frame)
+{
+    unsigned int drawCalls = 0;
+    glUseProgram(frame.illuminationProgram);
+    glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &frame.subroutine);
+    for (GLuint b = 0; b < 3; b++)
+    {
+        glActiveTexture(GL_TEXTURE0 + frame.lightUnit + b);
+        glBindTexture(GL_TEXTURE_BUFFER, frame.lightTextures[b]);
+    }
+    GLsizei count = frame.prepare(PLANE_PASS, PLANE_ENTITY);
+    glActiveTexture(GL_TEXTURE0 + frame.planeUnit);
+    glBindTexture(GL_TEXTURE_2D, frame.textures[PLANE_ENTITY]);
+    for (size_t m = 0; m < frame.meshes[PLANE_ENTITY].size(); m++, drawCalls++)
+    {
+        glBindVertexArray(frame.meshes[PLANE_ENTITY][m].VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, frame.meshes[PLANE_ENTITY][m].indices, GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+    }
+
+    // (the glEnable(GL_POINT_SIZE) of the previous loop is omitted: it is not a capability, and it only raised GL_INVALID_ENUM)
+    count = frame.prepare(PARTICLE_PASS, 0);
+    if (count > 0)
+    {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+        glUseProgram(frame.particleProgram);
+        glBindVertexArray(frame.particleVAO);
+        glPointSize(frame.particleSize);
+        glDrawArrays(GL_POINTS, 0, count);
+        drawCalls++;
+        glBindVertexArray(0);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    glUseProgram(frame.illuminationProgram);
+    glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &frame.subroutine);
+    for (int kind = PIN_ENTITY; kind <= BALL_ENTITY; kind++)
+    {
+        count = frame.prepare(KIND_PASS, kind);
+        glActiveTexture(GL_TEXTURE0 + frame.objectUnit);
+        glBindTexture(GL_TEXTURE_2D, frame.textures[kind]);
+        for (size_t m = 0; m < frame.meshes[kind].size(); m++, drawCalls++)
+        {
+            glBindVertexArray(frame.meshes[kind][m].VAO);
+            glDrawElementsInstanced(GL_TRIANGLES, frame.meshes[kind][m].indices, GL_UNSIGNED_INT, 0, count);
+            glBindVertexArray(0);
+        }
+    }
+
+    glUseProgram(frame.instanceProgram);
+    count = frame.prepare(INSTANCE_PASS, 0);
+    glActiveTexture(GL_TEXTURE0 + frame.instanceUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, frame.instanceTexture);
+    for (size_t m = 0; m < frame.instanceMeshes.size(); m++, drawCalls++)
+    {
+        glBindVertexArray(frame.instanceMeshes[m].VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, frame.instanceMeshes[m].indices, GL_UNSIGNED_INT, 0, count);
+        glBindVertexArray(0);
+    }
+    return drawCalls;
+}
+
+//////////////////////////////////////////
+// benchmark of the calls elided by the cache of the OpenGL state: the render passes of the game (see render_passes.h) are run on the recording stub,
+// and compared with the same passes sending the calls directly
+// the objects have the names and the units used by the game; the subroutine of the illumination changes every 10 frames (as when the user presses a key),
+// and the numbers of particles, balls and visible objects of the background change from frame to frame (some frames have no particles and no balls)
+void BenchmarkRenderState(int frames)
+{
+    // names of the objects, as created by the game (3 Shader Programs, a VAO for each mesh, the textures of the kinds, and the texture buffers)
+    enum { ILLUMINATION_PROGRAM = 1, PARTICLE_PROGRAM, INSTANCE_PROGRAM };
+    enum { PLANE_VAO = 1, PIN_VAO, BALL_VAO, PARTICLE_VAO, CUBE_VAO };
+    enum { PLANE_TEXTURE = 1, PIN_TEXTURE, BALL_TEXTURE, INSTANCE_TEXTURE, LIGHT_DATA_TEXTURE };
+    FrameObjects frame;
+    frame.illuminationProgram = ILLUMINATION_PROGRAM;
+    frame.particleProgram = PARTICLE_PROGRAM;
+    frame.instanceProgram = INSTANCE_PROGRAM;
+    const GLuint kindTextures[NUM_ENTITY_KINDS] = { PLANE_TEXTURE, PIN_TEXTURE, BALL_TEXTURE };
+    const GLuint kindVAOs[NUM_ENTITY_KINDS] = { PLANE_VAO, PIN_VAO, BALL_VAO };
+    // cube.obj for the lanes and the pins (36 indices), sphere.obj for the balls
+    const GLsizei kindIndices[NUM_ENTITY_KINDS] = { 36, 36, 2280 };
+    for (int kind = 0; kind < NUM_ENTITY_KINDS; kind++)
+    {
+        frame.textures[kind] = kindTextures[kind];
+        MeshDraw mesh = { kindVAOs[kind], kindIndices[kind] };
+        frame.meshes[kind].assign(1, mesh);
+    }
+    frame.planeUnit = 1;
+    frame.objectUnit = 0;
+    frame.lightUnit = 3;
+    for (GLuint b = 0; b < 3; b++)
+        frame.lightTextures[b] = LIGHT_DATA_TEXTURE + b;
+    frame.particleVAO = PARTICLE_VAO;
+    frame.particleSize = 20.0f;
+    frame.instanceUnit = 2;
+    frame.instanceTexture = INSTANCE_TEXTURE;
+    MeshDraw cube = { CUBE_VAO, 36 };
+    frame.instanceMeshes.assign(1, cube);
+    int f = 0;
+    frame.prepare = [&f](RenderPass pass, int kind) -> GLsizei
+    {
+        if (pass == PLANE_PASS)
+            return planeNum;
+        if (pass == PARTICLE_PASS)
+            return (f % 7 < 2) ? 0 : 500 + 37 * (f % 13);
+        if (pass == KIND_PASS)
+            return (kind == PIN_ENTITY) ? planeNum * total_pins : (f / 5) % 3;
+        return 8000 + 97 * (f % 17);
+    };
+
+    const char* names[NUM_RECORDED_CALLS] = { "programs", "subroutines", "active units", "textures", "VAOs", "blending", "capabilities", "point size", "draws" };
+    std::cout << "Frames: " << frames << std::endl;
+    std::cout << "passes\t";
+    for (int c = 0; c < NUM_RECORDED_CALLS; c++)
+        std::cout << names[c] << "\t";
+    std::cout << "calls/frame\telided/frame\tidentical" << std::endl;
+
+    // calls sent directly: the reference state and parameters of the draw calls
+    recordedState = RecordedState();
+    std::fill(recordedCalls, recordedCalls + NUM_RECORDED_CALLS, 0UL);
+    recordedDraws.clear();
+    unsigned long drawCalls = 0;
+    for (f = 0; f < frames; f++)
+    {
+        frame.subroutine = (GLuint)(f / 10) % 4;
+        drawCalls += RenderPassesDirect(frame);
+    }
+    vector<RecordedDraw> reference = recordedDraws;
+    bool counted = (drawCalls == recordedCalls[RECORDED_DRAW]);
+    unsigned long directCalls = 0;
+    std::cout << "direct\t";
+    for (int c = 0; c < NUM_RECORDED_CALLS; c++)
+    {
+        std::cout << (double)recordedCalls[c] / frames << "\t";
+        if (c != RECORDED_DRAW)
+            directCalls += recordedCalls[c];
+    }
+    std::cout << (double)directCalls / frames << "\t-\t-" << std::endl;
+
+    // the render passes of the game, through the cache: the cache is invalidated after the overlay at each frame (as in the game), or never (frames without the overlay)
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool overlay = (pass == 0);
+        recordedState = RecordedState();
+        std::fill(recordedCalls, recordedCalls + NUM_RECORDED_CALLS, 0UL);
+        recordedDraws.clear();
+        RenderState state;
+        unsigned long elided = 0;
+        drawCalls = 0;
+        for (f = 0; f < frames; f++)
+        {
+            frame.subroutine = (GLuint)(f / 10) % 4;
+            drawCalls += RenderPasses(state, frame);
+            elided += state.TotalElided();
+            if (overlay)
+                state.Invalidate();
+            state.ResetCounters();
+        }
+        bool identical = (recordedDraws == reference);
+        counted = counted && (drawCalls == recordedCalls[RECORDED_DRAW]);
+        unsigned long cachedCalls = 0;
+        std::cout << (overlay ? "cached, overlay" : "cached") << "\t";
+        for (int c = 0; c < NUM_RECORDED_CALLS; c++)
+        {
+            std::cout << (double)recordedCalls[c] / frames << "\t";
+            if (c != RECORDED_DRAW)
+                cachedCalls += recordedCalls[c];
+        }
+        std::cout << (double)cachedCalls / frames << "\t" << (double)elided / frames << "\t" << (identical ? "yes" : "NO") << std::endl;
+    }
+    std::cout << "Draw calls counted by the passes: " << (counted ? "correct" : "WRONG") << std::endl;
+}
@@ -1,10 +1,51 @@
 #version 410 core
 layout (location = 0) in vec3 pos;
-layout (location = 3) in mat4 instanceMatrix;
+// index of the instance in the buffer of the instances (see utils/instance_manager.h)
+layout (location = 3) in uint instanceIndex;
 
-uniform mat4 projection, view, modelMatrix;
+// view and projection matrices (shared by all the shaders, see 13_illumination_models_ML_TX.vert)
+layout (std140) uniform Camera
+{
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+};
+uniform mat4 modelMatrix;
+// instances: 3 texels for each instance, position and scale, rotation (quaternion x, y, z, w), and spin (axis * angular speed, phase)
+uniform samplerBuffer instanceData;
+// 0: floats (GL_RGBA32F); 1: quantized (GL_RGBA16, normalized to [0, 1]), see utils/instance_transform.h
+uniform int instanceEncoding;
+// bounds of the quantization
+uniform vec3 boundsMin, boundsSize;
+uniform float maxScale, maxSpinSpeed;
+// time of the animation (in seconds)
+uniform float time;
 
 void main()
 {
-    gl_Position = projection * view * modelMatrix * instanceMatrix * vec4(pos, 1.0f); 
-}
\ No newline at end of file
+    int first = int(instanceIndex) * 3;
+    vec4 positionScale = texelFetch(instanceData, first);
+    vec4 q = texelFetch(instanceData, first + 1);
+    vec4 spin = texelFetch(instanceData, first + 2);
+    if (instanceEncoding == 1)
+    {
+        positionScale = vec4(boundsMin + positionScale.xyz * boundsSize, positionScale.w * maxScale);
+        q = normalize(q * 2.0f - 1.0f);
+        spin = vec4((spin.xyz * 2.0f - 1.0f) * maxSpinSpeed, spin.w * 6.28318530718f);
+    }
+
+    // spin of phase + speed * time around the axis, after the initial rotation (same formulas of InstanceTransform::Rotation)
+    float speed = length(spin.xyz);
+    vec3 axis = (speed > 0.0f) ? spin.xyz / speed : vec3(0.0f);
+    float halfAngle = 0.5f * (spin.w + speed * time);
+    vec3 spinVector = axis * sin(halfAngle);
+    float spinScalar = cos(halfAngle);
+    q = vec4(spinScalar * q.xyz + q.w * spinVector + cross(spinVector, q.xyz), spinScalar * q.w - dot(spinVector, q.xyz));
+
+    // rotation matrix of the quaternion (same formulas of InstanceTransform::Matrix)
+    mat3 rotation = mat3(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.w * q.z), 2.0f * (q.x * q.z - q.w * q.y),
+                         2.0f * (q.x * q.y - q.w * q.z), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z + q.w * q.x),
+                         2.0f * (q.x * q.z + q.w * q.y), 2.0f * (q.y * q.z - q.w * q.x), 1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+    // translate * scale * rotate
+    vec3 instancePos = positionScale.xyz + positionScale.w * (rotation * pos);
+    gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(instancePos, 1.0f); 
+}
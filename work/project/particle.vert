@@ -1,15 +1,19 @@
 #version 410 core
+// each vertex is a particle, with its position and its color (interleaved in the same VBO)
 layout (location = 0) in vec3 position;
+layout (location = 1) in vec4 color;
 
 out vec4 ParticleColor;
 
-uniform vec4 color;
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 modelMatrix;
+// view and projection matrices (shared by all the shaders, see 13_illumination_models_ML_TX.vert)
+layout (std140) uniform Camera
+{
+    mat4 projectionMatrix;
+    mat4 viewMatrix;
+};
 
 void main()
 {
     ParticleColor = color;
-    gl_Position = projection * view * modelMatrix * vec4((position),  1.0f);
-}
\ No newline at end of file
+    gl_Position = projectionMatrix * viewMatrix * vec4(position, 1.0f);
+}
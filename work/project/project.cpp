@@ -13,6 +13,13 @@
 #include <utils/camera.h>
 #include <utils/model.h>
 #include <utils/physics.h>
+#include <utils/instance_buffer.h>
+#include <utils/particles.h>
+#include <utils/culling.h>
+#include <utils/instance_manager.h>
+#include <utils/uniform_buffer.h>
+#include <utils/light_buffer.h>
+#include <utils/render_state.h>
 
 // GLM libraries for math operations
 #include <glm/glm.hpp>
@@ -20,15 +27,19 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// lanes, pins and balls of the scene (shared with the headless simulation)
+#include "bowling_scene.h"
+#include "background.h"
+// state changes and draw calls of a frame (shared with the headless simulation)
+#include "render_passes.h"
+
 #include <iostream>
+#include <chrono>
 
 // for images (textures)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image/stb_image.h>
 
-// number of lights in the scene
-#define NR_LIGHTS 3
-
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -73,8 +84,10 @@ GLboolean wireframe = GL_FALSE;
 GLuint current_subroutine = 0;
 // a vector for all the shader subroutines names used and swapped in the application
 vector<std::string> shaders;
+// index in the Shader Program of each subroutine of the shaders vector (the name -> index table is built only once, by SetupShader)
+vector<GLuint> subroutineIndices;
 
-// the name of the subroutines are searched in the shaders, and placed in the shaders vector (to allow shaders swapping)
+// the name of the subroutines are searched in the shaders, and placed in the shaders vector with their indices (to allow shaders swapping)
 void SetupShader(int shader_program);
 // print on console the name of current shader subroutine
 void PrintCurrentShader(int subroutine);
@@ -85,12 +98,19 @@ GLint LoadTexture(const char* path);
 vector<GLint> textureID;
 
 // uniforms to be passed to shaders
-// pointlights positions
+// pointlights positions (the main lights of the scene, with a radius covering the whole scene)
 glm::vec3 lightPositions[] = {
     glm::vec3(5.0f, 10.0f, 10.0f),
     glm::vec3(-5.0f, 10.0f, 10.0f),
     glm::vec3(5.0f, 10.0f, -10.0f),
 };
+const int numMainLights = sizeof(lightPositions) / sizeof(lightPositions[0]);
+const float mainLightRadius = 1000.0f;
+// number of small colored lights moving above the lanes (they are assigned to the screen tiles they illuminate, see utils/light_tiles.h)
+int numExtraLights = 64;
+const int maxExtraLights = 1024;
+// all the lights of the current frame
+vector<PointLight> sceneLights;
 
 // specular and ambient components
 GLfloat specularColor[] = {1.0,1.0,1.0};
@@ -106,36 +126,60 @@ GLfloat alpha = 0.2f;
 // Fresnel reflectance at 0 degree (Schlik's approximation)
 GLfloat F0 = 0.9f;
 
-// dimension of the bullets (global because we need it also in the keyboard callback)
-glm::vec3 ball_size = glm::vec3(0.16f, 0.16f, 0.16f);
+// data of the uniform blocks of the shaders, with the std140 layout (see utils/uniform_buffer.h)
+// binding points of the blocks
+enum UniformBlocks {CAMERA_BLOCK, LIGHTS_BLOCK, MATERIAL_BLOCK};
+// view and projection matrices, shared by all the Shader Programs
+struct CameraBlock
+{
+    glm::mat4 projectionMatrix;
+    glm::mat4 viewMatrix;
+};
+// tiling of the lights: size of the tiles, number of tiles on the x-axis and on the y-axis, number of lights
+struct LightsBlock
+{
+    glm::ivec4 tiling;
+};
+// material of the illumination shader: each vec3 is followed by a float, which fills its last 4 bytes
+struct MaterialBlock
+{
+    glm::vec3 ambientColor;
+    float Ka;
+    glm::vec3 specularColor;
+    float Kd;
+    float Ks, shininess, alpha, F0;
+    float repeat;
+    float padding[3];
+};
+static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock must follow the std140 layout");
+
+// We create the data of a material, with the colors and the coefficients of the illumination models set above
+MaterialBlock CreateMaterial(GLfloat ka, GLfloat kd, GLfloat ks, GLfloat repetitions);
+// We create the i-th extra light at a time (in seconds)
+PointLight ExtraLight(int index, float time);
+// We collect the VAO and the number of indices of the meshes of a model, for the render passes
+vector<MeshDraw> ModelDraws(const Model &model);
 
 // instance of the physics class
 Physics bulletSimulation;
+// lanes, pins and balls of the scene, with their rigid bodies and rendering data
+EntityRegistry registry;
 
 // we initialize an array of booleans for each keyboard key
 bool keys[1024];
 
 int repeat = 1;
 
-// credentials of a particle
-struct Particle {
-    glm::vec3 Position;         // initialization position will be equal to the objects (pins and balls)
-    glm::vec3 Speed;            // will be equal to the objects (pins and balls)
-    glm::vec4 Color;            // will be green or white to distinguish better
-    float     Life;             // each particle dies in a short time just after rendering
-
-    // constructor
-    Particle() : Position(0.0f), Speed(0.0f), Color(0.0f), Life(0.0f)
-    {}
-};
+// worker threads for the parallel loops (e.g., the update of the particles), on all the hardware threads
+JobSystem jobSystem;
 
-std::vector<Particle> particles;    // vector for all particles
-int particleNum = 500;              // this can be tweaked with ImGui
+// particles emitted by the pins and the balls (see utils/particles.h)
+// the number of particles used can be tweaked with ImGui
+ParticleSystem particleSystem(500);
+std::vector<ParticleVertex> particleVertices;   // positions and colors of the alive particles, uploaded at each frame
 
-// two functions to instantiate each particle after previous one's death
-int lastUsedParticle = 0;
-int FirstUnusedParticle();
-void RespawnParticle(Particle &particle, btRigidBody &body, btTransform transform, glm::vec3 obj_size);
+// the function requests a new particle from the position of an object
+void RespawnParticle(btRigidBody &body, btTransform transform, glm::vec3 obj_size);
 
 int main()
 {
@@ -192,25 +236,26 @@ int main()
     ImGui_ImplGlfw_InitForOpenGL(window, true);     // window will be opened
     ImGui_ImplOpenGL3_Init("#version 410 core");    // must be the same version
 
-    // VAO and VBO for the particles
+    // the update of large numbers of particles is split among the worker threads
+    particleSystem.jobs = &jobSystem;
+
+    // VAO and VBO for the particles: a single vertex for each alive particle, with position and color interleaved
+    // the VBO is filled at each frame, so it is created empty
     unsigned int particleVAO, particleVBO;
-    float particle_quad[] = {0.0f, 0.0f, 0.0f}; // to initialize
-    // set up mesh and attribute properties
+    // number of vertices which can be stored in the VBO
+    size_t particleCapacity = 0;
     glGenVertexArrays(1, &particleVAO);
     glGenBuffers(1, &particleVBO);
     glBindVertexArray(particleVAO);
-    // fill mesh buffer
     glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(particle_quad), particle_quad, GL_STATIC_DRAW);
-    // set mesh attributes
+    // position (location = 0)
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (GLvoid*)offsetof(ParticleVertex, Position));
+    // color (location = 1)
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleVertex), (GLvoid*)offsetof(ParticleVertex, Color));
     glBindVertexArray(0);
-
-    // vector that includes all particles
-    // to store the particles that will be born and die over and over
-    for (unsigned int i = 0; i < particleNum; ++i)
-        particles.push_back(Particle());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     // different shaders for instanced objects, particles, and main objects
     Shader instance_shader("instance.vert", "instance.frag");
@@ -220,125 +265,105 @@ int main()
     SetupShader(illumination_shader.Program);
     PrintCurrentShader(current_subroutine);
 
+    // all the drawing goes through the cache of the state (see utils/render_state.h): the redundant calls (programs, textures, VAOs, blending, point size) are skipped,
+    // and the subroutine is applied again only when the illumination program is actually used again
+    RenderState renderState;
+
+    // the data shared by the Shader Programs are in Uniform Buffer Objects: the camera and the tiling of the lights are uploaded once per frame,
+    // and the materials only once (see utils/uniform_buffer.h)
+    UniformBuffer cameraBuffer(sizeof(CameraBlock), CAMERA_BLOCK);
+    UniformBuffer lightsBuffer(sizeof(LightsBlock), LIGHTS_BLOCK);
+    // the materials share the same binding point: we bind the buffer of the material before drawing
+    UniformBuffer planeMaterial(sizeof(MaterialBlock), MATERIAL_BLOCK);
+    UniformBuffer objectMaterial(sizeof(MaterialBlock), MATERIAL_BLOCK);
+    // we connect the blocks of each Shader Program to the binding points, only once
+    cameraBuffer.BindBlock(illumination_shader.Program, "Camera");
+    cameraBuffer.BindBlock(particle_shader.Program, "Camera");
+    cameraBuffer.BindBlock(instance_shader.Program, "Camera");
+    lightsBuffer.BindBlock(illumination_shader.Program, "Lights");
+    planeMaterial.BindBlock(illumination_shader.Program, "Material");
+    // for the plane, we make it mainly Lambertian, by setting at 0 the specular component
+    MaterialBlock material = CreateMaterial(0.0f, 0.6f, 0.0f, 1.0f);
+    planeMaterial.Update(&material);
+    material = CreateMaterial(0.0f, 0.6f, 0.0f, (GLfloat)repeat);
+    objectMaterial.Update(&material);
+    CameraBlock cameraData;
+    LightsBlock lightsData;
+
+    // the lights are assigned to the screen tiles on the threads of the job system, and uploaded in texture buffers at each frame
+    LightTiler lightTiler;
+    lightTiler.jobs = &jobSystem;
+    LightBuffer lightBuffer;
+
+    // we determine the position in the Shader Programs of the other uniform variables, only once (see utils/shader.h):
+    // in the rendering loop, the values are assigned with the typed setters, without searching the names
+    GLint textureLocation = illumination_shader.Uniform("tex");
+    GLint instanceModelLocation = instance_shader.Uniform("modelMatrix");
+    GLint instanceColorLocation = instance_shader.Uniform("color");
+
     // no model for particles because it will be drawn directly as GL_POINTS
     Model instanceModel("../../models/cube.obj");
     Model planeModel("../../models/cube.obj");
     Model pinModel("../../models/cube.obj");
     Model ballModel("../../models/sphere.obj");
 
-    // plane has to have a little height to be a collidable
-    glm::vec3 plane_pos = glm::vec3(0.0f, -1.0f, 4.0f);
-    glm::vec3 plane_size = glm::vec3(2.0f, 0.1f, 11.0f);
-    glm::vec3 plane_rot = glm::vec3(0.0f, 0.0f, 0.0f);
-
     // textures
     textureID.push_back(LoadTexture("../../textures/bowling_pin_TEX.jpg"));
     textureID.push_back(LoadTexture("../../textures/bowling_floor.jpeg"));
     textureID.push_back(LoadTexture("../../textures/bowling_ball.jpg"));
 
-    // first initialization of the instanced objects
-    int amount = 10000;                                 // this can be tweaked with ImGui
-    glm::mat4* modelMatrices;                           // to store all 10000 objects
-    modelMatrices = new glm::mat4[amount];
     srand(static_cast<unsigned int>(glfwGetTime()));    // initialize random function
-    float offset = 6.0f;                                // random constant for their lineup
-    for (unsigned int i = 0; i < amount; i++)       // to create the cross (X)
-    {
-        glm::mat4 model = glm::mat4(1.0f);
-        // displacement value creates randomness for each instanced object
-        float displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-        // to create the letter X, each object goes left if even or right if odd
-        // they meet at the middle and moves apart towards the end
-        float x = (i % 2 == 0) ? -90.0f + (0.0165f * i) + displacement + 5.0f : 90.0f - (0.0165f * i) - displacement - 5.0f;
-        displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-        // on a bigger picture, it is setting the height of all objects on y-axis
-        float y = -33.0f + (0.0165f * i) + displacement;
-        // whole shape's thickness
-        float z = displacement * 2.0f;
-
-        //scaling each object between 0.1f-0.5f
-        float scale = static_cast<float>((rand() % 40) / 100.0 + 0.1);
-        // rotation to create randomness on each object
-        float rotAngle = static_cast<float>((rand() % 360));
-
-        model = glm::translate(model, glm::vec3(x, y, z));
-        model = glm::scale(model, glm::vec3(scale));
-        model = glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
-
-        modelMatrices[i] = model;
-    }
-
-    // reserving them a buffer
-    unsigned int buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, amount * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
 
-    // setting their matrices into their instance vertex from their mesh class
-    for (unsigned int i = 0; i < instanceModel.meshes.size(); i++)
-    {
-        unsigned int instanceVAO = instanceModel.meshes[i].VAO;
-        glBindVertexArray(instanceVAO);
-        // the reason they are 3,4,5,6 is because it is located at 3
-        // at its vertex shader, and it is mat4 (4 vec4)
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)0);
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4)));
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(2 * sizeof(glm::vec4)));
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(3 * sizeof(glm::vec4)));
-
-        glVertexAttribDivisor(3, 1);
-        glVertexAttribDivisor(4, 1);
-        glVertexAttribDivisor(5, 1);
-        glVertexAttribDivisor(6, 1);
-
-        glBindVertexArray(0);
-    }
+    // the instanced objects of the background are generated on a worker thread, and uploaded incrementally (see utils/instance_manager.h)
+    // the objects outside the view frustum are culled on the CPU (see utils/culling.h):
+    // their bounding spheres are computed from the radius of the model
+    float instanceRadius = 0.0f;
+    for (GLuint m = 0; m < instanceModel.meshes.size(); m++)
+        for (GLuint v = 0; v < instanceModel.meshes[m].vertices.size(); v++)
+            instanceRadius = glm::max(instanceRadius, glm::length(instanceModel.meshes[m].vertices[v].Position));
+    int amount = 10000;                                 // this can be tweaked with ImGui
+    // the objects depend only on the seed (see background.h), so they are generated in parallel on the job system
+    // they are stored quantized (24 bytes each, with the spin), with the bounds of the maximum number of objects of the slider
+    const int maxAmount = 2000000;
+    InstanceManager instanceManager(instanceModel, instanceRadius, BackgroundInstance, static_cast<unsigned int>(glfwGetTime() * 1000.0), &jobSystem,
+                                    QUANTIZED_INSTANCES, BackgroundQuantizer(maxAmount));
+    instanceManager.Request(amount);
+
+    // the lanes, the pins and the balls are rendered with instancing too: their matrices are taken from the rigid bodies
+    // the lanes are static, so their buffer is filled only once
+    InstanceBuffer planeInstances(planeModel, GL_STATIC_DRAW);
+    InstanceBuffer pinInstances(pinModel);
+    InstanceBuffer ballInstances(ballModel);
+    InstanceBuffer* kindInstances[NUM_ENTITY_KINDS] = { &planeInstances, &pinInstances, &ballInstances };
+    // model matrices of the entities of each kind, collected at each frame
+    vector<glm::mat4> kindMatrices[NUM_ENTITY_KINDS];
+
+    // rendering data shared by all the entities of the same kind
+    registry.SetKind(PLANE_ENTITY, &planeModel, plane_size, textureID[1]);
+    registry.SetKind(PIN_ENTITY, &pinModel, pin_size, textureID[0]);
+    registry.SetKind(BALL_ENTITY, &ballModel, ball_size, textureID[2]);
+    // pins and balls emit particles while they move
+    SetupEmitters(registry);
 
     // creating three planes with mass=0 to not being a movable object
-    btRigidBody* plane = bulletSimulation.createRigidBody(BOX,plane_pos,plane_size,plane_rot,0.0f,0.2f,0.2f);
-    btRigidBody* plane2 = bulletSimulation.createRigidBody(BOX,(plane_pos + glm::vec3(5.0f,0.0f,0.0f)),plane_size,plane_rot,0.0f,0.2f,0.2f);
-    btRigidBody* plane3 = bulletSimulation.createRigidBody(BOX,(plane_pos + glm::vec3(10.0f,0.0f,0.0f)),plane_size,plane_rot,0.0f,0.2f,0.2f);
-
-    // we set the maximum delta time for the update of the physical simulation
-    GLfloat maxSecPerFrame = 1.0f / 60.0f;
-
-    // First 10 bowling pins to be in a triangle shape
-    GLint num_rows = 4;
-    // total number of the pins per plane
-    GLint total_pins = num_rows * (num_rows + 1) / 2;
-    GLint i,j;
-    // position of the pin
-    glm::vec3 pin_pos;
-    // dimension of the pin
-    glm::vec3 pin_size = glm::vec3(0.12f, 0.38f, 0.12f);
-    // placeholder rotation
-    glm::vec3 pin_rot = glm::vec3(0.0f, 0.0f, 0.0f);
-    // rigid body
-    btRigidBody* pin;
-
-    // creating triangle shape for the first 10 pins (their (x, z) coordinates):
-    //     (-0.75f, -3.0f)    (-0.25f, -3.0f)   (0.25f, -3.0f)    (0.75f, -3.0f)
-    //              (-0.5f, -2.5f)   (0.0f, -2.5f)    (0.5f, -2.5f)
-    //                      (-0.25f, -2.0f)   (0.25f, -2.0f)
-    //                              (0.0f, -1.5f)
-
-    for (int h = 0; h < 3; h++)
-    {
-        for(i = 0; i < num_rows; i++)
-        {
-            for(j = 0; j < (num_rows - i); j++ ) // to make it decrease row by row, it has to be equal to i
-            {
-                pin_pos = glm::vec3((h * 5.0f + ((-0.75f + 0.25f * i) + 0.5f * j)), 0.0f, (i * 0.5 - 3.0f));
+    CreateLanes(bulletSimulation, registry);
 
-                // bowling pins are created with masses 1.5, 2.5, and 3.5, respectively
-                pin = bulletSimulation.createRigidBody(BOX,pin_pos,pin_size,pin_rot,1.5f+float(h),0.5f,0.5f);
-            }
-        }
+    // bowling pins are created with masses 1.5, 2.5, and 3.5, respectively (see bowling_scene.h)
+    CreatePins(bulletSimulation, registry);
+
+    // array of 16 floats = "native" matrix of OpenGL.
+    // We need it as an intermediate data structure to "convert" the Bullet matrix to a GLM matrix
+    GLfloat matrix[16];
+    btTransform transform;
+
+    // the planes are static, so their transformation is the initial one
+    for (size_t p = 0; p < registry.kinds[PLANE_ENTITY].size(); p++)
+    {
+        Entity &plane = registry.kinds[PLANE_ENTITY][p];
+        plane.body->getWorldTransform().getOpenGLMatrix(matrix);
+        kindMatrices[PLANE_ENTITY].push_back(glm::make_mat4(matrix) * glm::scale(glm::mat4(1.0f), plane.size));
     }
+    planeInstances.Update(kindMatrices[PLANE_ENTITY].data(), (GLsizei)kindMatrices[PLANE_ENTITY].size());
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
     projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, 0.1f, 10000.0f);
@@ -346,19 +371,111 @@ int main()
     // helper boolean value to set the cursor to the center at the beginning of the game
     bool gameStarted = false;
 
-    // Model and Normal transformation matrices for the objects in the scene: we set to identity
+    // Model transformation matrices for the objects in the scene: we set to identity
+    // (the normal matrices are calculated in the vertex shader, from the per-instance model matrices)
     glm::mat4 instanceModelMatrix = glm::mat4(1.0f);
-    glm::mat4 particleModelMatrix = glm::mat4(1.0f);
-    glm::mat4 planeModelMatrix = glm::mat4(1.0f);
-    glm::mat3 planeNormalMatrix = glm::mat3(1.0f);
     glm::mat4 objModelMatrix = glm::mat4(1.0f);
-    glm::mat3 objNormalMatrix = glm::mat3(1.0f);
+
+    // number of draw calls issued in the last frame
+    GLuint drawCalls = 0;
+    // searches of uniform names in the last frame (it must be 0: the locations are determined before the rendering loop)
+    unsigned long uniformLookups = 0;
+    illumination_shader.lookups = particle_shader.lookups = instance_shader.lookups = 0;
+    // CPU time (in milliseconds) spent in the last frame to pack and upload the particles, and number of particles drawn
+    double particleSubmitTime = 0.0;
+    size_t aliveParticles = 0;
+    // time of the current frame (in seconds)
+    GLfloat currentFrame = 0.0f;
+
+    // the OpenGL objects drawn by the render passes of each frame (see render_passes.h)
+    FrameObjects frame;
+    frame.illuminationProgram = illumination_shader.Program;
+    frame.particleProgram = particle_shader.Program;
+    frame.instanceProgram = instance_shader.Program;
+    for (int kind = 0; kind < NUM_ENTITY_KINDS; kind++)
+    {
+        frame.textures[kind] = registry.defaults[kind].texture;
+        frame.meshes[kind] = ModelDraws(*registry.defaults[kind].model);
+    }
+    // the texture of the plane is read from the texture unit 1, the ones of the pins and of the balls from the texture unit 0
+    frame.planeUnit = 1;
+    frame.objectUnit = 0;
+    // the buffers of the lights are read from the texture units 3, 4 and 5 (used only by the lights)
+    frame.lightUnit = 3;
+    for (int b = 0; b < 3; b++)
+        frame.lightTextures[b] = lightBuffer.textures[b];
+    frame.particleVAO = particleVAO;
+    frame.particleSize = 20.0f;          // size of the particles
+    // the instances are read from the texture buffer bound to the texture unit 2
+    frame.instanceUnit = 2;
+    frame.instanceTexture = instanceManager.dataTexture;
+    frame.instanceMeshes = ModelDraws(instanceModel);
+
+    // the work of each pass not involving the state of OpenGL: uniforms, materials, upload of the buffers, and culling
+    frame.prepare = [&](RenderPass pass, int kind) -> GLsizei
+    {
+        if (pass == PLANE_PASS)
+        {
+            lightBuffer.SetSamplers(illumination_shader, frame.lightUnit);
+            // material and texture of the plane
+            planeMaterial.Bind();
+            illumination_shader.SetInt(textureLocation, frame.planeUnit);
+            // we render all the planes with a single instanced draw call (their matrices have been set at the beginning)
+            return planeInstances.count;
+        }
+        if (pass == PARTICLE_PASS)
+        {
+            // all the alive particles are copied in a single vertex buffer, and drawn with a single draw call
+            std::chrono::high_resolution_clock::time_point particleStart = std::chrono::high_resolution_clock::now();
+            aliveParticles = particleSystem.Pack(particleVertices);
+            if (aliveParticles > 0)
+            {
+                glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+                // the buffer is reallocated only if it is not large enough, otherwise it is orphaned
+                // (see utils/instance_buffer.h)
+                if (particleVertices.size() > particleCapacity)
+                    particleCapacity = particleVertices.size();
+                glBufferData(GL_ARRAY_BUFFER, particleCapacity * sizeof(ParticleVertex), NULL, GL_STREAM_DRAW);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, aliveParticles * sizeof(ParticleVertex), particleVertices.data());
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            }
+            particleSubmitTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - particleStart).count();
+            return (GLsizei)aliveParticles;
+        }
+        if (pass == KIND_PASS)
+        {
+            // material of the pins and of the balls
+            objectMaterial.Bind();
+            // the matrices are uploaded in the instance buffer of the kind, and all the objects of the kind are drawn with a single instanced draw call
+            kindInstances[kind]->Update(kindMatrices[kind].data(), (GLsizei)kindMatrices[kind].size());
+            illumination_shader.SetInt(textureLocation, frame.objectUnit);
+            return kindInstances[kind]->count;
+        }
+
+        // objects of the background: we reset to identity at each frame
+        instanceModelMatrix = glm::mat4(1.0f);
+        instanceModelMatrix = glm::translate(instanceModelMatrix, glm::vec3(0.0f, 0.0f, -50.0f));
+        instanceModelMatrix = glm::rotate(instanceModelMatrix, glm::radians(orientationY), glm::vec3(0.0f, 0.0f, 1.0f));
+        instance_shader.SetMat4(instanceModelLocation, instanceModelMatrix);
+
+        // to create nice color flow from red to blue
+        float dynamicRed = abs(sin(currentFrame/2));
+        float dynamicBlue = abs(cos(currentFrame/2));
+        instance_shader.SetVec4(instanceColorLocation, glm::vec4(dynamicRed, 0.0f, dynamicBlue, 1.0f));
+
+        // we cull the objects of the background against the frustum of the complete transformation,
+        // and we upload only the indices of the visible ones
+        instanceManager.Cull(projection * view * instanceModelMatrix, amount);
+        // each object spins around its own axis: the animation is evaluated in the shader, from the time
+        instanceManager.SetUniforms(instance_shader, frame.instanceUnit, currentFrame);
+        return instanceManager.visibleCount;
+    };
 
     while (!glfwWindowShouldClose(window))
     {
         // we determine the time passed from the beginning
         // and we calculate time difference between current frame rendering and the previous one
-        GLfloat currentFrame = glfwGetTime();
+        currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
@@ -371,6 +488,7 @@ int main()
         view = camera.GetViewMatrix();
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawCalls = 0;
 
         // we set the rendering mode
         if (wireframe) {
@@ -396,239 +514,118 @@ int main()
             gameStarted = true;
         }
 
-        bulletSimulation.dynamicsWorld->stepSimulation((deltaTime < maxSecPerFrame ? deltaTime : maxSecPerFrame),10);
-
-        /////////////////// PLANE ////////////////////////////////////////////////
-        illumination_shader.Use();
-        // we search inside the Shader Program the name of the subroutine, and we get the numerical index
-        GLuint index = glGetSubroutineIndex(illumination_shader.Program, GL_FRAGMENT_SHADER, shaders[current_subroutine].c_str());
-        // we activate the subroutine using the index (this is where shaders swapping happens)
-        glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &index);
-
-        // we determine the position in the Shader Program of the uniform variables
-        GLint textureLocation = glGetUniformLocation(illumination_shader.Program, "tex");
-        GLint repeatLocation = glGetUniformLocation(illumination_shader.Program, "repeat");
-        GLint matAmbientLocation = glGetUniformLocation(illumination_shader.Program, "ambientColor");
-        GLint matSpecularLocation = glGetUniformLocation(illumination_shader.Program, "specularColor");
-        GLint kaLocation = glGetUniformLocation(illumination_shader.Program, "Ka");
-        GLint kdLocation = glGetUniformLocation(illumination_shader.Program, "Kd");
-        GLint ksLocation = glGetUniformLocation(illumination_shader.Program, "Ks");
-        GLint shineLocation = glGetUniformLocation(illumination_shader.Program, "shininess");
-        GLint alphaLocation = glGetUniformLocation(illumination_shader.Program, "alpha");
-        GLint f0Location = glGetUniformLocation(illumination_shader.Program, "F0");
-
-        // we assign the value to the uniform variables
-        glUniform3fv(matAmbientLocation, 1, ambientColor);
-        glUniform3fv(matSpecularLocation, 1, specularColor);
-        glUniform1f(shineLocation, shininess);
-        glUniform1f(alphaLocation, alpha);
-        glUniform1f(f0Location, F0);
-        // for the plane, we make it mainly Lambertian, by setting at 0 the specular component
-        glUniform1f(kaLocation, 0.0f);
-        glUniform1f(kdLocation, 0.6f);
-        glUniform1f(ksLocation, 0.0f);
-
-        // we pass projection and view matrices to the Shader Program
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-
-        // we pass each light position to the shader
-        for (GLuint i = 0; i < NR_LIGHTS; i++)
-        {
-            string number = to_string(i);
-            glUniform3fv(glGetUniformLocation(illumination_shader.Program, ("lights[" + number + "]").c_str()), 1, glm::value_ptr(lightPositions[i]));
-        }
+        // the physical simulation advances with fixed ticks, decoupled from the frame rate (see utils/physics.h)
+        bulletSimulation.Step(deltaTime);
+        // the bodies fallen from the lanes are removed from the registry and from the simulation, all together after the step
+        RetireFallenBodies(bulletSimulation, registry);
 
-        // texture for plane
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, textureID[1]);
-        glUniform1i(textureLocation, 1);
-        glUniform1f(repeatLocation, 1.0f);
+        // we upload the projection and view matrices once for all the Shader Programs
+        cameraData.projectionMatrix = projection;
+        cameraData.viewMatrix = view;
+        cameraBuffer.Update(&cameraData);
 
-        int planeNum = 3;   // same number we created the rigidbodies
-        for (int i = 0; i < planeNum; i++)
+        // we assign the lights (main lights, and extra lights) to the screen tiles, and we upload them
+        sceneLights.clear();
+        for (int i = 0; i < numMainLights; i++)
         {
-            // we create the transformation matrix
-            // we reset to identity at each frame
-            planeModelMatrix = glm::mat4(1.0f);
-            planeNormalMatrix = glm::mat3(1.0f);
-            planeModelMatrix = glm::translate(planeModelMatrix, glm::vec3(plane_pos.x + i*5, plane_pos.y, plane_pos.z));
-            planeModelMatrix = glm::scale(planeModelMatrix, plane_size);
-            planeNormalMatrix = glm::inverseTranspose(glm::mat3(view*planeModelMatrix));
-            glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(planeModelMatrix));
-            glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(planeNormalMatrix));
-
-            // we render the plane
-            planeModel.Draw();
+            PointLight light = { lightPositions[i], mainLightRadius, glm::vec3(1.0f), 1.0f };
+            sceneLights.push_back(light);
         }
+        for (int i = 0; i < numExtraLights; i++)
+            sceneLights.push_back(ExtraLight(i, currentFrame));
+        lightTiler.Cull(sceneLights.data(), (int)sceneLights.size(), view, projection, width, height);
+        lightBuffer.Update(lightTiler);
+        lightsData.tiling = glm::ivec4(lightTiler.tileSize, lightTiler.tilesX, lightTiler.tilesY, lightTiler.numLights);
+        lightsBuffer.Update(&lightsData);
 
-        /////////////////// OBJECTS (PINS + BALL) ////////////////////////////////////////////////
-        // array of 16 floats = "native" matrix of OpenGL.
-        // We need it as an intermediate data structure to "convert" the Bullet matrix to a GLM matrix
-        GLfloat matrix[16];
-        btTransform transform;
+        // we upload the objects of the background generated since the last frame
+        // (before the rendering passes: the reallocation of their buffer binds a texture outside the render state)
+        instanceManager.Update();
 
-        // we need two variables to manage the rendering of both pins and bullets
+        /////////////////// OBJECTS (PINS + BALL) ////////////////////////////////////////////////
+        // we need a variable to manage the rendering of both pins and bullets
         glm::vec3 obj_size;
-        Model* objectModel;
-
-        // we ask Bullet to provide the total number of Rigid Bodies in the scene
-        // at the beginning they are 26 (the static plane + the falling pins)
-        int num_cobjs = bulletSimulation.dynamicsWorld->getNumCollisionObjects();
 
-        // we cycle among all the Rigid Bodies (starting from 1 to avoid the plane)
-        for (i=planeNum; i<num_cobjs;i++)
+        // we cycle among the pins and the bullets, kind by kind, and we collect their model matrices
+        for (int kind = PIN_ENTITY; kind <= BALL_ENTITY; kind++)
         {
-            // the first 30 objects are the falling pins
-            if (i <= planeNum * (total_pins + (planeNum - 1*planeNum)) + planeNum - 1)
-            {
-                // we point objectModel to the pin
-                objectModel = &pinModel;
-                obj_size = pin_size;
-
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textureID[0]);
-                glUniform1i(textureLocation, 0);
-                glUniform1f(repeatLocation, repeat);
-            }
-            // over 30 (number of pins), there are bullets
-            else
-            {
-                // we point objectModel to the ball
-                objectModel = &ballModel;
-                obj_size = ball_size;
-
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, textureID[2]);
-                glUniform1i(textureLocation, 0);
-                glUniform1f(repeatLocation, repeat);
-            }
-
-            // we take the Collision Object from the list
-            btCollisionObject* obj = bulletSimulation.dynamicsWorld->getCollisionObjectArray()[i];
+            std::vector<Entity> &entities = registry.kinds[kind];
+            kindMatrices[kind].clear();
 
-            // we upcast it in order to use the methods of the main class RigidBody
-            btRigidBody* body = btRigidBody::upcast(obj);
+            for (size_t e = 0; e < entities.size(); e++)
+            {
+                btRigidBody* body = entities[e].body;
+                obj_size = entities[e].size;
 
-            // we take the transformation matrix of the rigid boby, as calculated by the physics engine
-            body->getMotionState()->getWorldTransform(transform);
+                // we take the transformation matrix of the rigid boby, as calculated by the physics engine
+                // (interpolated between the last two ticks of the simulation)
+                bulletSimulation.GetInterpolatedTransform(body, transform);
 
-            // we convert the Bullet matrix (transform) to an array of floats
-            transform.getOpenGLMatrix(matrix);
-            // we reset to identity at each frame
-            objModelMatrix = glm::mat4(1.0f);
-            objNormalMatrix = glm::mat3(1.0f);
+                // we convert the Bullet matrix (transform) to an array of floats
+                transform.getOpenGLMatrix(matrix);
 
-            // if it has already fallen from the plane
-            // no need to make them fall to infinity
-            // this if statement to not render after its y-axis is -7.0f
-            if (transform.getOrigin().getY() >= -7.0f)
-            {
-                // putting particles before the objects so that
-                // main objects will be rendered after the particles
-                // like creating a hierarchical system
-                int nr_new_particles = 2;
-                // add new particles
-                for (int i = 0; i < nr_new_particles; ++i)
-                {
-                    // finding dead particles and respawning new ones
-                    int unusedParticle = FirstUnusedParticle();
-                    RespawnParticle(particles[unusedParticle], *body, transform, obj_size);
-                }
-                // update all other particles
-                for (int i = 0; i < particles.size(); ++i)
+                // the bodies fallen below fallLimit have already been retired after the step,
+                // but the interpolated transformation could be still below it
+                if (transform.getOrigin().getY() >= fallLimit)
                 {
-                    Particle &p = particles[i];
-                    p.Life -= deltaTime;            // reduce its lifetime
-                    if (p.Life > 0.0f)          // if particle is alive
-                    {
-                        p.Position -= p.Speed * deltaTime;
-                        p.Color.a -= deltaTime * 2.5f;
-                    }
+                    // each moving object requests new particles through its emitter: they are created and updated by the particle system after the loop
+                    int nr_new_particles = particleSystem.Emit(entities[e].emitter, body->getLinearVelocity().length(), deltaTime);
+                    for (int i = 0; i < nr_new_particles; ++i)
+                        RespawnParticle(*body, transform, obj_size);
+
+                    // the model matrix of the object is collected: all the objects of the kind are drawn together after the loop
+                    objModelMatrix = glm::make_mat4(matrix) * glm::scale(glm::mat4(1.0f), obj_size);
+                    kindMatrices[kind].push_back(objModelMatrix);
                 }
-                glBlendFunc(GL_SRC_ALPHA, GL_ONE);  // creating a blend effect on particles
-                particle_shader.Use();
-                for (Particle particle : particles) // for each particle
-                {
-                    if (particle.Life > 0.0f)       // if they are alive
-                    {
-                        particleModelMatrix = glm::mat4(1.0f);
-                        particleModelMatrix = glm::translate(particleModelMatrix, particle.Position);
-                        glUniformMatrix4fv(glGetUniformLocation(particle_shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-                        glUniformMatrix4fv(glGetUniformLocation(particle_shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-                        glUniformMatrix4fv(glGetUniformLocation(particle_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(particleModelMatrix));
-                        glUniform4fv(glGetUniformLocation(particle_shader.Program, "color"), 1, glm::value_ptr(particle.Color));
-                        // drawing the particles
-                        glBindVertexArray(particleVAO);
-                        glEnable(GL_POINT_SIZE);
-                        glPointSize(20);            // size of the particles
-                        glDrawArrays(GL_POINTS, 0, 3);
-                        glBindVertexArray(0);
-                    }
-                }
-                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // finishing the blending effect
-
-                // drawing the objects (pins or balls)
-                illumination_shader.Use();
-                // we search inside the Shader Program the name of the subroutine, and we get the numerical index
-                index = glGetSubroutineIndex(illumination_shader.Program, GL_FRAGMENT_SHADER, shaders[current_subroutine].c_str());
-                // we activate the subroutine using the index (this is where shaders swapping happens)
-                glUniformSubroutinesuiv(GL_FRAGMENT_SHADER, 1, &index);
-
-                objModelMatrix = glm::make_mat4(matrix) * glm::scale(objModelMatrix, obj_size);
-                objNormalMatrix = glm::inverseTranspose(glm::mat3(view*objModelMatrix));
-                glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(objModelMatrix));
-                glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(objNormalMatrix));
-
-                objectModel->Draw();
-                // we "reset" the matrix
-                objModelMatrix = glm::mat4(1.0f);
-            }
-            // if its y-axis value is below -7.0f
-            // its rigid body should also be destroyed
-            // since it will not be rendered
-            else
-            {
-                body->~btRigidBody();
             }
         }
 
-        /////////////////// INSTANCED OBJECTS ////////////////////////////////////////////////
-        instance_shader.Use();
-        // we reset to identity at each frame
-        instanceModelMatrix = glm::mat4(1.0f);
-        instanceModelMatrix = glm::translate(instanceModelMatrix, glm::vec3(0.0f, 0.0f, -50.0f));
-        instanceModelMatrix = glm::rotate(instanceModelMatrix, glm::radians(orientationY), glm::vec3(0.0f, 0.0f, 1.0f));
-        glUniformMatrix4fv(glGetUniformLocation(instance_shader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(instance_shader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(instance_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(instanceModelMatrix));
+        // the particles requested by all the objects are created, and each particle is updated once
+        particleSystem.Update(deltaTime);
 
-        // to create nice color flow from red to blue
-        float dynamicRed = abs(sin(currentFrame/2));
-        float dynamicBlue = abs(cos(currentFrame/2));
-        glUniform4f(glGetUniformLocation(instance_shader.Program, "color"), dynamicRed, 0.0f, dynamicBlue, 1.0f);
+        /////////////////// RENDER PASSES ////////////////////////////////////////////////
+        // lanes, particles (drawn before the objects, so that main objects will be rendered after the particles), pins and balls, and objects of the background
+        // all the drawing goes through the cache of the state, with the subroutine chosen by the user (this is where shaders swapping happens, see render_passes.h)
+        frame.subroutine = subroutineIndices[current_subroutine];
+        drawCalls += RenderPasses(renderState, frame);
 
-        // drawing the instanced objects
-        instance_shader.Use();
-        for (unsigned int i = 0; i < instanceModel.meshes.size(); i++)
-        {
-            glBindVertexArray(instanceModel.meshes[i].VAO);
-            glDrawElementsInstanced(GL_TRIANGLES, static_cast<unsigned int>(instanceModel.meshes[i].indices.size()), GL_UNSIGNED_INT, 0, amount);
-            glBindVertexArray(0);
-        }
+        uniformLookups = illumination_shader.lookups + particle_shader.lookups + instance_shader.lookups;
+        illumination_shader.lookups = particle_shader.lookups = instance_shader.lookups = 0;
 
         // ImGui window creation and its parameters
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         ImGui::Begin("Bowling Game"); 
-        ImGui::SliderInt(" ##1", &amount, 100, 10000, "Instance Amount = %.3f");
-        ImGui::SliderInt(" ##2", &particleNum, 10, 500, "Particle Amount = %.3f");
+        // the missing objects are requested to the generator only when the slider is moved
+        if (ImGui::SliderInt(" ##1", &amount, 100, maxAmount, "Instance Amount = %d", ImGuiSliderFlags_Logarithmic))
+            instanceManager.Request(amount);
+        ImGui::Text("Instances: %d / %d visible - cull %.3f ms", instanceManager.visibleCount, amount, instanceManager.culler.cullTime);
+        ImGui::Text("Instances uploaded: %d / %d generated - upload %.3f ms - capacity %d (%d bytes each, %lu reallocations)", instanceManager.uploaded, instanceManager.generator.Generated(), instanceManager.uploadTime, instanceManager.capacity, instanceManager.instanceSize, instanceManager.reallocations);
+        // the budget of the particle system is changed only when the slider is moved
+        int particleBudget = particleSystem.particleNum;
+        if (ImGui::SliderInt(" ##2", &particleBudget, 10, 100000, "Particle Amount = %d", ImGuiSliderFlags_Logarithmic))
+            particleSystem.SetBudget(particleBudget);
+        ImGui::Text("Physics: %d ticks/frame - %.3f ms/frame - %lu dropped ticks", bulletSimulation.ticksLastFrame, bulletSimulation.stepTimeLastFrame, bulletSimulation.droppedTicks);
+        ImGui::Text("Draw calls: %u - uniform lookups: %lu", drawCalls, uniformLookups);
+        ImGui::Text("State calls: %lu issued / %lu elided - programs %lu / %lu - subroutines %lu / %lu - textures %lu / %lu - VAOs %lu / %lu", renderState.TotalIssued(), renderState.TotalElided(),
+                    renderState.issued[PROGRAM_CALLS], renderState.elided[PROGRAM_CALLS], renderState.issued[SUBROUTINE_CALLS], renderState.elided[SUBROUTINE_CALLS],
+                    renderState.issued[TEXTURE_CALLS], renderState.elided[TEXTURE_CALLS], renderState.issued[VERTEX_ARRAY_CALLS], renderState.elided[VERTEX_ARRAY_CALLS]);
+        ImGui::SliderInt(" ##3", &numExtraLights, 0, maxExtraLights, "Extra Lights = %d");
+        ImGui::Text("Lights: %d - tiles %d x %d (max %d lights) - tiling %.3f ms - upload %ld bytes", lightTiler.numLights, lightTiler.tilesX, lightTiler.tilesY, lightTiler.maxTileLights, lightTiler.cullTime, (long)lightBuffer.uploadedBytes);
+        ImGui::Combo("Particle Saturation", (int*)&particleSystem.saturation, "drop new\0steal oldest\0grow\0");
+        ImGui::Text("Particles: %lu alive - update %.3f ms (%d threads) - submit %.3f ms", (unsigned long)aliveParticles, particleSystem.updateTime, jobSystem.NumThreads(), particleSubmitTime);
+        ImGui::Text("Particle emission: %.0f/s requested - scale %.3f", particleSystem.requestedRate, particleSystem.emissionScale);
+        ImGui::Text("Particles dropped: %lu - stolen: %lu - capacity: %d (%lu reallocations)", particleSystem.droppedSpawns, particleSystem.stolenSpawns, particleSystem.store.capacity, particleSystem.reallocations);
+        ImGui::Text("Collision Shapes: %d - Rigid bodies: %d - Retired: %lu", bulletSimulation.collisionShapes.size(), bulletSimulation.dynamicsWorld->getNumCollisionObjects(), bulletSimulation.totalRetired);
         ImGui::ShowMetricsWindow();
         ImGui::End();
         //ImGui::ShowDemoWindow();
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        // the ImGui renderer changes the state of OpenGL without the render state
+        renderState.Invalidate();
+        renderState.ResetCounters();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -639,40 +636,29 @@ int main()
     illumination_shader.Delete();
     particle_shader.Delete();
     instance_shader.Delete();
+    // we delete the uniform buffers
+    cameraBuffer.Delete();
+    lightsBuffer.Delete();
+    planeMaterial.Delete();
+    objectMaterial.Delete();
+    lightBuffer.Delete();
+    // we delete the instance buffers
+    instanceManager.Delete();
+    planeInstances.Delete();
+    pinInstances.Delete();
+    ballInstances.Delete();
+    // we delete the particles buffers
+    glDeleteVertexArrays(1, &particleVAO);
+    glDeleteBuffers(1, &particleVBO);
     // we delete the data of the physical simulation
+    bulletSimulation.PrintMemoryReport();
     bulletSimulation.Clear();
 
     glfwTerminate();
     return 0;
 }
 
-int FirstUnusedParticle()
-{
-    // to increase the efficiency, first it is searched from the last used particle
-    // because it takes shorter time to find
-    for (int i = lastUsedParticle; i < particleNum; ++i)
-    {
-        if (particles[i].Life <= 0.0f)
-        {
-            lastUsedParticle = i;
-            return i;
-        }
-    }
-    // if the for loop above does not work, we do a usual linear search
-    for (int i = 0; i < lastUsedParticle; ++i)
-    {
-        if (particles[i].Life <= 0.0f)
-        {
-            lastUsedParticle = i;
-            return i;
-        }
-    }
-    // if turns out that all of them are alive
-    lastUsedParticle = 0;
-    return 0;
-}
-
-void RespawnParticle(Particle &particle, btRigidBody &body, btTransform transform, glm::vec3 obj_size)
+void RespawnParticle(btRigidBody &body, btTransform transform, glm::vec3 obj_size)
 {
     // Current position of the ball
     glm::vec3 pos = glm::vec3(transform.getOrigin().getX(), transform.getOrigin().getY(), transform.getOrigin().getZ());
@@ -680,11 +666,9 @@ void RespawnParticle(Particle &particle, btRigidBody &body, btTransform transfor
     glm::vec3 speed = glm::vec3(body.getLinearVelocity().getX(), body.getLinearVelocity().getY(), body.getLinearVelocity().getZ());
 
     float rColor = 0.5f + ((rand() % 100) / 100.0f);
-    particle.Position = pos;
     // if the object is a ball, then it will be green. If it is a pin, then it will be white
-    particle.Color = (obj_size == ball_size) ? glm::vec4(0.0f, rColor, 0.0f, 1.0f) : glm::vec4(rColor, rColor, rColor, 1.0f);
-    particle.Life = 1.0f;
-    particle.Speed = speed * 0.1f;
+    glm::vec4 color = (obj_size == ball_size) ? glm::vec4(0.0f, rColor, 0.0f, 1.0f) : glm::vec4(rColor, rColor, rColor, 1.0f);
+    particleSystem.Spawn(pos, speed * 0.1f, color);
 }
 
 ///////////////////////////////////////////
@@ -727,6 +711,7 @@ void SetupShader(int program)
             glGetActiveSubroutineName(program, GL_FRAGMENT_SHADER, s[j], 256, &len, name);
             std::cout << "\t" << s[j] << " - " << name << "\n";
             shaders.push_back(name);
+            subroutineIndices.push_back(s[j]);
         }
         std::cout << std::endl;
 
@@ -777,6 +762,42 @@ GLint LoadTexture(const char* path)
     return textureImage;
 }
 
+//////////////////////////////////////////
+// we create the data of a material (std140 layout of the Material block of 14_illumination_models_ML_TX.frag)
+MaterialBlock CreateMaterial(GLfloat ka, GLfloat kd, GLfloat ks, GLfloat repetitions)
+{
+    MaterialBlock material;
+    material.ambientColor = glm::make_vec3(ambientColor);
+    material.Ka = ka;
+    material.specularColor = glm::make_vec3(specularColor);
+    material.Kd = kd;
+    material.Ks = ks;
+    material.shininess = shininess;
+    material.alpha = alpha;
+    material.F0 = F0;
+    material.repeat = repetitions;
+    return material;
+}
+
+//////////////////////////////////////////
+// we create the i-th extra light at a time (in seconds): each light has a random color and range, and it moves on a circle above the lanes
+PointLight ExtraLight(int index, float time)
+{
+    CounterRandom random(7, (uint32_t)index);
+    glm::vec3 center = glm::vec3(-3.0f + 16.0f * random.Uniform(), 0.5f * random.Uniform(), -8.0f + 23.0f * random.Uniform());
+    float speed = 0.5f + random.Uniform();
+    float phase = 6.28318530718f * random.Uniform();
+
+    PointLight light;
+    light.position = center + glm::vec3(glm::cos(phase + speed * time), 0.0f, glm::sin(phase + speed * time));
+    light.radius = 1.5f + 2.5f * random.Uniform();
+    // saturated color: the largest component is 1
+    glm::vec3 color = glm::vec3(random.Uniform(), random.Uniform(), random.Uniform());
+    light.color = color / glm::max(color.r, glm::max(color.g, color.b));
+    light.intensity = 1.5f;
+    return light;
+}
+
 //////////////////////////////////////////
 // If one of the WASD keys is pressed, the camera is moved accordingly (the code is in utils/camera.h)
 void apply_camera_movements()
@@ -833,24 +854,13 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     /// BULLET MANAGEMENT (SPACE KEY)
     // if space is pressed, we "shoot" a bullet in the scene
     // the initial trajectory of the bullet is given by a vector from the position of the camera to the mouse cursor position, which must be converted from Viewport Coordinates back to World Coordinate
-    btVector3 impulse;
-    // we need a initial rotation, even if useless for a ball
-    glm::vec3 rot = glm::vec3(10.0f, 0.0f, 3.0f);
     glm::vec4 shoot;
-    // initial Speed of the bullet
-    GLfloat shootInitialSpeed = 40.0f;
-    // rigid body of the bullet
-    btRigidBody* ball;
     // matrix for the inverse matrix of view and projection
     glm::mat4 unproject;
 
     // if space is pressed
     if(key == GLFW_KEY_SPACE && action == GLFW_PRESS)
     {
-        // Bowling ball is created with a realistic mass which is 2.85 kg (average mass IRL)
-        // y-axis value is -0.6 to create the effect of sending the ball close to ground as in real-life
-        ball = bulletSimulation.createRigidBody(SPHERE,glm::vec3(camera.Position.x, -0.6f, camera.Position.z),ball_size,rot,2.85f,0.2f,0.2f);
-
         // we must retro-project the coordinates of the mouse pointer, in order to have a point in world coordinate to be used to determine a vector from the camera (= direction and orientation of the bullet)
         // we convert the cursor position (taken from the mouse callback) from Viewport Coordinates to Normalized Device Coordinate (= [-1,1] in both coordinates)
         shoot.x = (cursorX/screenWidth) * 2.0f - 1.0f;
@@ -866,10 +876,9 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         // we convert the position of the cursor from NDC to world coordinates, and we multiply the vector by the initial speed
         shoot = glm::normalize(unproject * shoot) * shootInitialSpeed;
 
-        // we apply the impulse and shoot the bullet in the scene
+        // the ball is created at the camera position on the ground, and the impulse is applied along the cursor direction (see bowling_scene.h)
         // N.B.) the graphical aspect of the bullet is treated in the rendering loop
-        impulse = btVector3(shoot.x, shoot.y, shoot.z);
-        ball->applyCentralImpulse(impulse);
+        LaunchBall(bulletSimulation, registry, camera.Position.x, camera.Position.z, glm::vec3(shoot));
     }
 
     // we keep trace of the pressed keys
@@ -920,4 +929,16 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
     // we pass the offset to the Camera class instance in order to update the rendering
     camera.ProcessMouseMovement(xoffset, yoffset);
-}
\ No newline at end of file
+}
+//////////////////////////////////////////
+// we collect the VAO and the number of indices of each mesh of a model (the per-instance attributes are set in the VAOs by the instance buffers)
+vector<MeshDraw> ModelDraws(const Model &model)
+{
+    vector<MeshDraw> draws;
+    for (GLuint m = 0; m < model.meshes.size(); m++)
+    {
+        MeshDraw draw = { model.meshes[m].VAO, (GLsizei)model.meshes[m].indices.size() };
+        draws.push_back(draw);
+    }
+    return draws;
+}
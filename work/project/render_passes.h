@@ -0,0 +1,113 @@
+/*
+Render passes:
+- the OpenGL state changes and the draw calls of a frame of the game (lanes, particles, pins and balls, objects of the background), all through the cache of the state (see utils/render_state.h)
+
+The sequence of the passes is shared by the game (project.cpp) and by the headless simulation (headless.cpp, --bench-render-state), which runs it on a recording stub of the OpenGL functions: the calls checked by the headless simulation are exactly the ones of the game.
+The passes receive the names of the OpenGL objects (programs, textures, VAOs of the meshes) in a FrameObjects structure, and they change the state only through the RenderState. The work of a pass not involving the state (uniforms, materials, upload of the buffers, culling) is done by the prepare callback of the caller, which returns the number of instances (or of points, for the particles) to draw:
+- PLANE_PASS and INSTANCE_PASS: called after their program is in use, and after the texture buffers of the lights (PLANE_PASS) are bound
+- PARTICLE_PASS: called before any state change, since the pass is skipped if there are no particles to draw
+- KIND_PASS: called for each kind of object (pins, then balls), after the illumination program is in use
+
+N.B.) glad and utils/render_state.h must be included before this file
+*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "entities.h"
+
+// passes of a frame, in order of drawing (KIND_PASS is repeated for the pins and for the balls)
+enum RenderPass { PLANE_PASS, PARTICLE_PASS, KIND_PASS, INSTANCE_PASS };
+
+/////////////////// MESHDRAW struct ///////////////////////
+// a mesh drawn by the passes: its VAO (with the per-instance attributes already set) and the number of its indices
+struct MeshDraw
+{
+    GLuint VAO;
+    GLsizei indices;
+};
+
+/////////////////// FRAMEOBJECTS struct ///////////////////////
+struct FrameObjects
+{
+    // Shader Programs, and index of the subroutine of the illumination model (fragment shader)
+    GLuint illuminationProgram, particleProgram, instanceProgram;
+    GLuint subroutine;
+    // texture and meshes of each kind of entity (the lanes, the pins and the balls)
+    GLuint textures[NUM_ENTITY_KINDS];
+    std::vector<MeshDraw> meshes[NUM_ENTITY_KINDS];
+    // texture units of the texture of the lanes, and of the textures of the pins and of the balls
+    GLuint planeUnit, objectUnit;
+    // texture buffers of the lights, bound to the texture units from lightUnit to lightUnit + 2
+    GLuint lightUnit;
+    GLuint lightTextures[3];
+    // VAO of the particles, and size of the points (in pixels)
+    GLuint particleVAO;
+    GLfloat particleSize;
+    // texture buffer of the objects of the background, its texture unit, and the meshes of their model
+    GLuint instanceUnit, instanceTexture;
+    std::vector<MeshDraw> instanceMeshes;
+
+    // the work of a pass not involving the state (kind is the kind of entity, for KIND_PASS): it returns the number of instances to draw
+    std::function<GLsizei(RenderPass pass, int kind)> prepare;
+};
+
+//////////////////////////////////////////
+// We draw count instances of each mesh: the VAO is bound only if it is not already bound, and it is not detached after the draw call
+inline unsigned int DrawMeshes(RenderState &state, const std::vector<MeshDraw> &meshes, GLsizei count)
+{
+    for (size_t m = 0; m < meshes.size(); m++)
+    {
+        state.BindVertexArray(meshes[m].VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, meshes[m].indices, GL_UNSIGNED_INT, 0, count);
+    }
+    return (unsigned int)meshes.size();
+}
+
+//////////////////////////////////////////
+// We draw the passes of a frame: the function returns the number of draw calls
+inline unsigned int RenderPasses(RenderState &state, const FrameObjects &frame)
+{
+    unsigned int drawCalls = 0;
+
+    // lanes: the subroutine is applied by the state when the program is used, and again each time the program is used after another one
+    state.SetSubroutines(frame.illuminationProgram, GL_FRAGMENT_SHADER, 1, &frame.subroutine);
+    state.UseProgram(frame.illuminationProgram);
+    for (GLuint b = 0; b < 3; b++)
+        state.BindTexture(frame.lightUnit + b, GL_TEXTURE_BUFFER, frame.lightTextures[b]);
+    GLsizei count = frame.prepare(PLANE_PASS, PLANE_ENTITY);
+    state.BindTexture(frame.planeUnit, GL_TEXTURE_2D, frame.textures[PLANE_ENTITY]);
+    drawCalls += DrawMeshes(state, frame.meshes[PLANE_ENTITY], count);
+
+    // particles: they are drawn before the objects, with a blend effect, in a single draw call
+    count = frame.prepare(PARTICLE_PASS, 0);
+    if (count > 0)
+    {
+        state.BlendFunc(GL_SRC_ALPHA, GL_ONE);
+        state.UseProgram(frame.particleProgram);
+        state.BindVertexArray(frame.particleVAO);
+        state.PointSize(frame.particleSize);
+        glDrawArrays(GL_POINTS, 0, count);
+        drawCalls++;
+        state.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // pins and balls: all the objects of a kind are drawn with a single instanced draw call
+    state.UseProgram(frame.illuminationProgram);
+    for (int kind = PIN_ENTITY; kind <= BALL_ENTITY; kind++)
+    {
+        count = frame.prepare(KIND_PASS, kind);
+        state.BindTexture(frame.objectUnit, GL_TEXTURE_2D, frame.textures[kind]);
+        drawCalls += DrawMeshes(state, frame.meshes[kind], count);
+    }
+
+    // objects of the background, read from their texture buffer
+    state.UseProgram(frame.instanceProgram);
+    count = frame.prepare(INSTANCE_PASS, 0);
+    state.BindTexture(frame.instanceUnit, GL_TEXTURE_BUFFER, frame.instanceTexture);
+    drawCalls += DrawMeshes(state, frame.instanceMeshes, count);
+
+    return drawCalls;
+}